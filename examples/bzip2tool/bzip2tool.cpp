@@ -121,6 +121,142 @@ bool Decompress(QString ifile,QString ofile)
   return false                                                      ;
 }
 
+bool Recover(QString ifile,QString ofile,int threads)
+{
+  QVariantList report                                                ;
+  bool         ok                                                    ;
+  ////////////////////////////////////////////////////////////////////
+  ok = RecoverBZip2File ( ifile , ofile , report , threads )         ;
+  for (int i = 0 ; i < report . count ( ) ; i++ )                    {
+    QVariantMap R = report [ i ] . toMap ( )                         ;
+    if ( 0 == R [ "Status" ] . toInt ( ) )                           {
+      nprintf ( QString ( "Block %1 : %2 bytes at %3"                )
+                . arg   ( R [ "Block"  ] . toInt      ( )            )
+                . arg   ( R [ "Size"   ] . toInt      ( )            )
+                . arg   ( R [ "Offset" ] . toLongLong ( )          ) ,
+                true                                                 ,
+                true                                               ) ;
+    } else                                                           {
+      nprintf ( QString ( "Block %1 : damaged , about %2 bytes lost at %3" )
+                . arg   ( R [ "Block"  ] . toInt      ( )            )
+                . arg   ( R [ "Lost"   ] . toLongLong ( )            )
+                . arg   ( R [ "Offset" ] . toLongLong ( )          ) ,
+                true                                                 ,
+                true                                               ) ;
+    }                                                                ;
+  }                                                                  ;
+  ////////////////////////////////////////////////////////////////////
+  if ( ! ok ) nprintf ( "Recovery failure" , true , true )           ;
+  return ok                                                          ;
+}
+
+// One line of the mode table printed by Benchmark
+typedef struct      {
+  const char * label ;
+  const char * key   ;
+  int          value ;
+} BenchMode          ;
+
+static const BenchMode BenchTable [ ] =  {
+  { "Speed 0"       , "Speed"    , 0 }  ,
+  { "Speed 1"       , "Speed"    , 1 }  ,
+  { "Speed 2"       , "Speed"    , 2 }  ,
+  { "Speed 3"       , "Speed"    , 3 }  ,
+  { "Archival"      , "Archival" , 1 }  ,
+  { "Sort byte"     , "Sort"     , 0 }  ,
+  { "Sort word"     , "Sort"     , 1 }  ,
+  { "Sort fallback" , "Sort"     , 2 }  ,
+}                                       ;
+
+static const int BenchModes = sizeof(BenchTable) / sizeof(BenchMode) ;
+
+// Best compression time in nanoseconds over rounds , -1 when the options
+// are refused ; bzip2 keeps the output of the last round
+qint64 Time                         (
+         const QByteArray  & data     ,
+         int                 level    ,
+         int                 rounds   ,
+         const QVariantMap & options  ,
+         QByteArray        & bzip2    )
+{
+  QVariantList  args                                                 ;
+  QElapsedTimer timer                                                ;
+  qint64        st = -1                                              ;
+  args << level << 30 << options                                    ;
+  for (int i = 0 ; i < rounds ; i++ )                                {
+    QtBZip2 Z                                                        ;
+    bzip2 . clear ( )                                                ;
+    timer . start ( )                                                ;
+    if ( ! Z . IsCorrect ( Z . BeginCompress ( args ) ) ) return -1  ;
+    Z . doCompress   ( data , bzip2 )                                ;
+    Z . CompressDone ( bzip2        )                                ;
+    qint64 c = timer . nsecsElapsed ( )                              ;
+    if ( ( st < 0 ) || ( c < st ) ) st = c                           ;
+  }                                                                  ;
+  return st                                                          ;
+}
+
+bool Benchmark(QString ifile,int level,int rounds)
+{
+  QByteArray    data                                                 ;
+  QByteArray    bzip2                                                ;
+  QByteArray    again                                                ;
+  QElapsedTimer timer                                                ;
+  qint64        ct = -1                                              ;
+  qint64        dt = -1                                              ;
+  ////////////////////////////////////////////////////////////////////
+  if ( ( ! LoadAll ( ifile , data ) ) || ( data . size ( ) <= 0 ) )  {
+    nprintf ( QString("Can not load %1").arg(ifile) , true , true )  ;
+    return false                                                     ;
+  }                                                                  ;
+  if ( rounds <= 0 ) rounds = 5                                      ;
+  ////////////////////////////////////////////////////////////////////
+  for (int i = 0 ; i < rounds ; i++ )                                {
+    bzip2 . clear ( )                                                ;
+    again . clear ( )                                                ;
+    timer . start ( )                                                ;
+    if ( ! ToBZip2   ( data  , bzip2 , level ) ) return false        ;
+    qint64 c = timer . nsecsElapsed ( )                              ;
+    timer . start ( )                                                ;
+    if ( ! FromBZip2 ( bzip2 , again         ) ) return false        ;
+    qint64 d = timer . nsecsElapsed ( )                              ;
+    if ( ( ct < 0 ) || ( c < ct ) ) ct = c                           ;
+    if ( ( dt < 0 ) || ( d < dt ) ) dt = d                           ;
+  }                                                                  ;
+  ////////////////////////////////////////////////////////////////////
+  double mb = data . size ( ) / 1000000.0                            ;
+  nprintf ( QString ( "%1 bytes -> %2 bytes , %3 , best of %4"       )
+            . arg   ( data  . size ( )                               )
+            . arg   ( bzip2 . size ( )                               )
+            . arg   ( ( again == data ) ? "verified" : "MISMATCH"    )
+            . arg   ( rounds                                       ) ,
+            true                                                     ,
+            true                                                   ) ;
+  nprintf ( QString ( "Compress   : %1 MB/s" )
+            . arg   ( mb * 1000000000.0 / qMax ( ct , (qint64) 1 ) , 0 , 'f' , 2 ) ,
+            true                                                     ,
+            true                                                   ) ;
+  nprintf ( QString ( "Decompress : %1 MB/s" )
+            . arg   ( mb * 1000000000.0 / qMax ( dt , (qint64) 1 ) , 0 , 'f' , 2 ) ,
+            true                                                     ,
+            true                                                   ) ;
+  ////////////////////////////////////////////////////////////////////
+  for (int i = 0 ; i < BenchModes ; i++ )                            {
+    QVariantMap options                                              ;
+    qint64      st                                                   ;
+    options [ BenchTable [ i ] . key ] = BenchTable [ i ] . value    ;
+    st = Time ( data , level , rounds , options , bzip2 )            ;
+    if ( st < 0 ) return false                                       ;
+    nprintf ( QString ( "%1 : %2 bytes , %3 MB/s"                    )
+              . arg   ( BenchTable [ i ] . label , -13               )
+              . arg   ( bzip2 . size ( )                             )
+              . arg   ( mb * 1000000000.0 / qMax ( st , (qint64) 1 ) , 0 , 'f' , 2 ) ,
+              true                                                   ,
+              true                                                 ) ;
+  }                                                                  ;
+  return ( again == data )                                           ;
+}
+
 bool JsBZip2(QString ifile,QString entry)
 {
   QString    m                                                               ;
@@ -164,6 +300,8 @@ void Help (void)
   nprintf("Compress   : bzip2tool -c -i input -o output.bz2 -l level",true,true) ;
   nprintf("Decompress : bzip2tool -e -i input.bz2 -o output"         ,true,true) ;
   nprintf("Javascript : bzip2tool -j -f function -i input.js"        ,true,true) ;
+  nprintf("Recover    : bzip2tool -r -i damaged.bz2 -o output -t threads",true,true) ;
+  nprintf("Benchmark  : bzip2tool -b -i input -l level -n rounds"  ,true,true) ;
 }
 
 int Interpret(QStringList cmds)
@@ -184,7 +322,13 @@ int Interpret(QStringList cmds)
   if ( "-j" == cmds [ 0 ] )            {
     ioa = 3                            ;
   }                                    ;
-  if ( ( ioa < 1 ) || ( ioa > 3 ) )    {
+  if ( "-r" == cmds [ 0 ] )            {
+    ioa = 4                            ;
+  }                                    ;
+  if ( "-b" == cmds [ 0 ] )            {
+    ioa = 5                            ;
+  }                                    ;
+  if ( ( ioa < 1 ) || ( ioa > 5 ) )    {
     Help ( )                           ;
     return 1                           ;
   }                                    ;
@@ -193,6 +337,8 @@ int Interpret(QStringList cmds)
   QString ofile = ""                   ;
   QString entry = ""                   ;
   int     l     = 9                    ;
+  int     t     = 0                    ;
+  int     n     = 5                    ;
   cmds . takeAt ( 0 )                  ;
   while ( cmds . count ( ) > 0 )       {
     if ( "-i" == cmds [ 0 ] )          {
@@ -225,6 +371,26 @@ int Interpret(QStringList cmds)
         return 1                       ;
       }                                ;
     } else
+    if ( "-t" == cmds [ 0 ] )          {
+      cmds . takeAt ( 0 )              ;
+      if ( cmds . count ( ) > 0 )      {
+        t = cmds [ 0 ] . toInt ( )     ;
+        cmds . takeAt ( 0 )            ;
+      } else                           {
+        Help ( )                       ;
+        return 1                       ;
+      }                                ;
+    } else
+    if ( "-n" == cmds [ 0 ] )          {
+      cmds . takeAt ( 0 )              ;
+      if ( cmds . count ( ) > 0 )      {
+        n = cmds [ 0 ] . toInt ( )     ;
+        cmds . takeAt ( 0 )            ;
+      } else                           {
+        Help ( )                       ;
+        return 1                       ;
+      }                                ;
+    } else
     if ( "-f" == cmds [ 0 ] )          {
       cmds . takeAt ( 0 )              ;
       if ( cmds . count ( ) > 0 )      {
@@ -243,6 +409,7 @@ int Interpret(QStringList cmds)
   switch ( ioa )                       {
     case 1                             :
     case 2                             :
+    case 4                             :
       if ( ( ifile.length ( ) <= 0 )  ||
            ( ofile.length ( ) <= 0 ) ) {
         Help ( )                       ;
@@ -256,6 +423,12 @@ int Interpret(QStringList cmds)
         return 1                       ;
       }                                ;
     break                              ;
+    case 5                             :
+      if ( ifile.length ( ) <= 0 )     {
+        Help ( )                       ;
+        return 1                       ;
+      }                                ;
+    break                              ;
   }                                    ;
   //////////////////////////////////////
   switch ( ioa )                       {
@@ -268,6 +441,12 @@ int Interpret(QStringList cmds)
     case 3                             :
       JsBZip2    ( ifile , entry     ) ;
     return 0                           ;
+    case 4                             :
+      Recover    ( ifile , ofile , t ) ;
+    return 0                           ;
+    case 5                             :
+      Benchmark  ( ifile , l , n     ) ;
+    return 0                           ;
   }                                    ;
   //////////////////////////////////////
   Help ( )                             ;
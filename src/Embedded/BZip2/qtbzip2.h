@@ -39,6 +39,39 @@ QT_BEGIN_NAMESPACE
 #define QT_BZIP2_LIB 1
 #define QT_BZIP2_VERSION 20210711911
 //////////////////////////////////////////////////////////////////////////////
+// Return codes, same values as libbzip2
+//////////////////////////////////////////////////////////////////////////////
+#define BZ_OK                0
+#define BZ_RUN_OK            1
+#define BZ_FLUSH_OK          2
+#define BZ_FINISH_OK         3
+#define BZ_STREAM_END        4
+#define BZ_SEQUENCE_ERROR    (-1)
+#define BZ_PARAM_ERROR       (-2)
+#define BZ_MEM_ERROR         (-3)
+#define BZ_DATA_ERROR        (-4)
+#define BZ_DATA_ERROR_MAGIC  (-5)
+#define BZ_IO_ERROR          (-6)
+#define BZ_UNEXPECTED_EOF    (-7)
+#define BZ_OUTBUFF_FULL      (-8)
+#define BZ_CONFIG_ERROR      (-9)
+// QtBZip2 extension : input judged not worth compressing, nothing consumed
+#define BZ_INCOMPRESSIBLE    (-10)
+// QtBZip2 extension : a decode limit ( output , ratio , blocks , time ) was hit
+#define BZ_LIMIT_EXCEEDED    (-11)
+//////////////////////////////////////////////////////////////////////////////
+// Memory governor policies , see BZip2SetMemoryBudget
+//////////////////////////////////////////////////////////////////////////////
+#define BZ_MEMORY_DEFAULT    0
+#define BZ_MEMORY_WAIT       1
+#define BZ_MEMORY_FAIL       2
+#define BZ_MEMORY_DEGRADE    3
+//////////////////////////////////////////////////////////////////////////////
+typedef struct              {
+  char   * data             ;
+  qint64   size             ;
+} BZip2Span                 ;
+//////////////////////////////////////////////////////////////////////////////
 class Q_BZIP2_EXPORT QtBZip2                                                 {
   ////////////////////////////////////////////////////////////////////////////
   public                                                                     :
@@ -51,6 +84,8 @@ class Q_BZIP2_EXPORT QtBZip2                                                 {
     virtual bool    isBZip2         ( QByteArray & header                  ) ;
     //////////////////////////////////////////////////////////////////////////
     virtual void    CleanUp         ( void                                 ) ;
+    virtual void    setHugePages    ( bool enable                          ) ;
+    virtual void    setMemoryPolicy ( int  policy                          ) ;
     //////////////////////////////////////////////////////////////////////////
     virtual bool    IsCorrect       ( int returnCode                       ) ;
     virtual bool    IsEnd           ( int returnCode                       ) ;
@@ -59,31 +94,110 @@ class Q_BZIP2_EXPORT QtBZip2                                                 {
     // Compression functions
     //////////////////////////////////////////////////////////////////////////
     virtual int     BeginCompress   ( int level = 9 , int workFactor = 30  ) ;
+    virtual int     BeginCompress   ( int level                              ,
+                                      int workFactor                         ,
+                                      qint64 sizeHint                      ) ;
     virtual int     BeginCompress   ( QVariantList arguments = QVariantList() ) ;
     virtual int     doCompress      ( const QByteArray & Source              ,
                                             QByteArray & Compressed        ) ;
+    virtual int     doCompress      ( const char       * Source              ,
+                                      qint64             length              ,
+                                      QIODevice        & Compressed        ) ;
+    virtual int     doCompress      ( QIODevice        & Source              ,
+                                      QIODevice        & Compressed        ) ;
+    virtual int     doCompress      ( const QList<QByteArray> & Sources      ,
+                                            QByteArray & Compressed        ) ;
+    virtual int     doCompress      ( const BZip2Span  * Sources             ,
+                                      int                count               ,
+                                      QByteArray       & Compressed        ) ;
     virtual int     doSection       (       QByteArray & Source              ,
                                             QByteArray & Compressed        ) ;
     virtual int     CompressDone    (       QByteArray & Compressed        ) ;
+    virtual int     CompressDone    (       QIODevice  & Compressed        ) ;
+    virtual int     Flush           (       QByteArray & Compressed          ,
+                                      bool endStream = false               ) ;
+    virtual int     Flush           (       QIODevice  & Compressed          ,
+                                      bool endStream = false               ) ;
+    virtual unsigned int InputCRC   ( void                                 ) ;
     //////////////////////////////////////////////////////////////////////////
     // Decompression functions
     //////////////////////////////////////////////////////////////////////////
     virtual int     BeginDecompress ( void                                 ) ;
+    virtual int     BeginDecompress ( QVariantList arguments               ) ;
     virtual int     doDecompress    ( const QByteArray & Source              ,
                                             QByteArray & Decompressed      ) ;
+    virtual int     doDecompress    ( const char       * Source              ,
+                                      qint64             length              ,
+                                      QIODevice        & Decompressed      ) ;
+    virtual int     doDecompress    ( QIODevice        & Source              ,
+                                      QIODevice        & Decompressed      ) ;
     virtual int     undoSection     (       QByteArray & Source              ,
                                             QByteArray & Decompressed      ) ;
     virtual int     DecompressDone  ( void                                 ) ;
     //////////////////////////////////////////////////////////////////////////
     virtual bool    IsTail          ( QByteArray & header                  ) ;
+    virtual QVariantList Streams    ( void                                 ) ;
     //////////////////////////////////////////////////////////////////////////
   protected                                                                  :
     //////////////////////////////////////////////////////////////////////////
     QMap < QString , QVariant > DebugInfo                                    ;
     void                      * BzPacket                                     ;
+    QVariantList                StreamInfo                                   ;
+    int                         HugePages                                    ;
+    int                         MemoryPolicy                                 ;
     //////////////////////////////////////////////////////////////////////////
     virtual bool    CompressHeader  ( QByteArray & Compressed              ) ;
     virtual bool    CompressTail    ( QByteArray & Compressed              ) ;
+    virtual void    StartStream     ( void                                 ) ;
+    virtual void    FinishStream    ( void                                 ) ;
+    virtual void    Allocator       ( void * stream                        ) ;
+    virtual int     DecompressRange ( const char       * Source              ,
+                                      qint64             length              ,
+                                      QByteArray       * array               ,
+                                      QIODevice        * device            ) ;
+    //////////////////////////////////////////////////////////////////////////
+  private                                                                    :
+    //////////////////////////////////////////////////////////////////////////
+}                                                                            ;
+//////////////////////////////////////////////////////////////////////////////
+// Compressing QIODevice over a sequential device such as QTcpSocket or
+// QLocalSocket.  With a latency set, written data is pushed out as complete
+// bzip2 streams once it is that old or that large; the idle flush needs an
+// event loop in the thread that owns the device.
+//////////////////////////////////////////////////////////////////////////////
+class Q_BZIP2_EXPORT QtBZip2Device : public QIODevice                        {
+  ////////////////////////////////////////////////////////////////////////////
+  public                                                                     :
+    //////////////////////////////////////////////////////////////////////////
+    explicit        QtBZip2Device   ( QIODevice * device                     ,
+                                      QObject   * parent = NULL            ) ;
+    virtual        ~QtBZip2Device   ( void                                 ) ;
+    //////////////////////////////////////////////////////////////////////////
+    virtual void    setLevel        ( int level                            ) ;
+    virtual void    setLatency      ( int msecs , qint64 bytes = 0         ) ;
+    //////////////////////////////////////////////////////////////////////////
+    virtual bool    open            ( OpenMode mode                        ) ;
+    virtual void    close           ( void                                 ) ;
+    virtual bool    isSequential    ( void                                 ) const ;
+    virtual qint64  bytesAvailable  ( void                                 ) const ;
+    virtual bool    flush           ( void                                 ) ;
+    //////////////////////////////////////////////////////////////////////////
+  protected                                                                  :
+    //////////////////////////////////////////////////////////////////////////
+    QIODevice * Device                                                       ;
+    QtBZip2     Writer                                                       ;
+    QtBZip2     Reader                                                       ;
+    QByteArray  Decoded                                                      ;
+    QTimer      Timer                                                        ;
+    int         Level                                                        ;
+    int         LatencyMs                                                    ;
+    qint64      LatencyBytes                                                 ;
+    //////////////////////////////////////////////////////////////////////////
+    virtual qint64  readData        ( char * data , qint64 maxSize         ) ;
+    virtual qint64  writeData       ( const char * data , qint64 size      ) ;
+    virtual void    Pull            ( void                                 ) ;
+    virtual void    Arrived         ( void                                 ) ;
+    virtual void    Expired         ( void                                 ) ;
     //////////////////////////////////////////////////////////////////////////
   private                                                                    :
     //////////////////////////////////////////////////////////////////////////
@@ -94,15 +208,53 @@ Q_BZIP2_EXPORT void       BZip2CRC        (const QByteArray & Data
 Q_BZIP2_EXPORT void       BZip2CRC        (int                length            ,
                                            const QByteArray & Data              ,
                                            unsigned int     & bcrc            ) ;
+Q_BZIP2_EXPORT qint64     BZip2CompressBound  (qint64         length        ) ;
+Q_BZIP2_EXPORT double     BZip2EstimateRatio  (const char   * data            ,
+                                               qint64         length        ) ;
+Q_BZIP2_EXPORT qint64     BZip2CompressInto   (char         * dst             ,
+                                               qint64         capacity        ,
+                                               const char   * src             ,
+                                               qint64         length          ,
+                                               int            level   = 9     ,
+                                               double         bailout = 0   ) ;
+Q_BZIP2_EXPORT qint64     BZip2DecompressInto (char         * dst             ,
+                                               qint64         capacity        ,
+                                               const char   * src             ,
+                                               qint64         length        ) ;
+Q_BZIP2_EXPORT qint64     BZip2DecompressInto (const BZip2Span * segments     ,
+                                               int            count           ,
+                                               const char   * src             ,
+                                               qint64         length        ) ;
 Q_BZIP2_EXPORT QByteArray BZip2Compress   (const QByteArray & data              ,
                                            int                level = 9       ) ;
 Q_BZIP2_EXPORT QByteArray BZip2Uncompress (const QByteArray & data            ) ;
+Q_BZIP2_EXPORT QByteArray BZip2Uncompress (const QByteArray & data              ,
+                                           const QVariantMap & limits           ,
+                                           int              * status = NULL   ) ;
 Q_BZIP2_EXPORT bool       ToBZip2         (const QByteArray & data              ,
                                                  QByteArray & bzip2             ,
                                            int                level      = 9    ,
                                            int                workFactor = 30 ) ;
+Q_BZIP2_EXPORT bool       ToBZip2         (const QList<QByteArray> & fragments  ,
+                                                 QByteArray & bzip2             ,
+                                           int                level      = 9    ,
+                                           int                workFactor = 30 ) ;
 Q_BZIP2_EXPORT bool       FromBZip2       (const QByteArray & bzip2             ,
                                                  QByteArray & data            ) ;
+Q_BZIP2_EXPORT bool       ToBZip2         (const char       * data              ,
+                                           qint64             length            ,
+                                           QIODevice        & bzip2             ,
+                                           int                level      = 9    ,
+                                           int                workFactor = 30 ) ;
+Q_BZIP2_EXPORT bool       FromBZip2       (const char       * bzip2             ,
+                                           qint64             length            ,
+                                           QIODevice        & data            ) ;
+Q_BZIP2_EXPORT bool       ToBZip2         (QIODevice        & data              ,
+                                           QIODevice        & bzip2             ,
+                                           int                level      = 9    ,
+                                           int                workFactor = 30 ) ;
+Q_BZIP2_EXPORT bool       FromBZip2       (QIODevice        & bzip2             ,
+                                           QIODevice        & data            ) ;
 Q_BZIP2_EXPORT bool       SaveBZip2       (QString            filename          ,
                                            QByteArray       & data              ,
                                            int                level      = 9    ,
@@ -115,6 +267,30 @@ Q_BZIP2_EXPORT bool       FileToBZip2     (QString            filename
                                            int                workFactor = 30 ) ;
 Q_BZIP2_EXPORT bool       BZip2ToFile     (QString            bzip2             ,
                                            QString            filename        ) ;
+Q_BZIP2_EXPORT bool       AppendBZip2     (QString            filename          ,
+                                           const QByteArray & data              ,
+                                           int                level      = 9    ,
+                                           int                workFactor = 30 ) ;
+Q_BZIP2_EXPORT bool       MergeBZip2      (const QList<QByteArray> & archives   ,
+                                                 QByteArray & bzip2           ) ;
+Q_BZIP2_EXPORT bool       SplitBZip2      (const QByteArray & bzip2             ,
+                                           QList<QByteArray> & pieces           ,
+                                           int                blocks     = 1  ) ;
+Q_BZIP2_EXPORT bool       RecoverBZip2    (const QByteArray & bzip2             ,
+                                                 QByteArray & data              ,
+                                           QVariantList     & report            ,
+                                           int                threads    = 0  ) ;
+Q_BZIP2_EXPORT bool       RecoverBZip2File(QString            bzip2             ,
+                                           QString            filename          ,
+                                           QVariantList     & report            ,
+                                           int                threads    = 0  ) ;
+Q_BZIP2_EXPORT void       BZip2SetHugePages  (bool enable                   ) ;
+Q_BZIP2_EXPORT QVariantMap BZip2HugePageStats (void                         ) ;
+Q_BZIP2_EXPORT void       BZip2SetThreads    (int threads = 0              ) ;
+Q_BZIP2_EXPORT QVariantMap BZip2SchedulerStats (void                        ) ;
+Q_BZIP2_EXPORT void       BZip2SetMemoryBudget (qint64 bytes                   ,
+                                                int    policy = BZ_MEMORY_WAIT ) ;
+Q_BZIP2_EXPORT QVariantMap BZip2MemoryStats (void                           ) ;
 //////////////////////////////////////////////////////////////////////////////
 QT_END_NAMESPACE
 //////////////////////////////////////////////////////////////////////////////
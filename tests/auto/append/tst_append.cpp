@@ -0,0 +1,70 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Append : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void appendStream ( void ) ;
+    void newFile      ( void ) ;
+    void emptyData    ( void ) ;
+} ;
+
+static QByteArray Contents(const QString & filename)
+{
+  QFile      F ( filename )                                       ;
+  QByteArray data                                                 ;
+  if ( ! F . open ( QIODevice::ReadOnly ) ) return data           ;
+  data = F . readAll ( )                                          ;
+  F . close ( )                                                   ;
+  return data                                                     ;
+}
+
+// the existing archive is left byte for byte , one decode reads both
+void tst_Append::appendStream(void)
+{
+  QTemporaryDir dir                                               ;
+  QString       name  = dir . path ( ) + "/append.bz2"            ;
+  QByteArray    old   = Sample ( 300000 , 1 )                     ;
+  QByteArray    more  = Sample ( 200000 , 2 )                     ;
+  QByteArray    last  = Noise  (  50000 , 3 )                     ;
+  QByteArray    tail                                              ;
+  QVERIFY  ( dir . isValid ( )                                  ) ;
+  QVERIFY  ( SaveBZip2 ( name , old , 9 )                       ) ;
+  QByteArray    before = Contents ( name )                        ;
+  QVERIFY  ( AppendBZip2 ( name , more , 1 )                    ) ;
+  QByteArray    after  = Contents ( name )                        ;
+  QVERIFY  ( after . size ( ) > before . size ( )               ) ;
+  QCOMPARE ( after . left ( before . size ( ) ) , before        ) ;
+  QVERIFY  ( ToBZip2 ( more , tail , 1 )                       ) ;
+  QCOMPARE ( after . mid  ( before . size ( ) ) , tail          ) ;
+  QCOMPARE ( Decode ( after ) , old + more                      ) ;
+  QVERIFY  ( AppendBZip2 ( name , last )                        ) ;
+  QCOMPARE ( Contents ( name ) . left ( after . size ( ) ) , after ) ;
+  QCOMPARE ( Decode ( Contents ( name ) ) , old + more + last   ) ;
+}
+
+void tst_Append::newFile(void)
+{
+  QTemporaryDir dir                                               ;
+  QString       name = dir . path ( ) + "/new.bz2"                ;
+  QByteArray    text = Sample ( 100000 , 4 )                      ;
+  QVERIFY  ( AppendBZip2 ( name , text , 5 )                    ) ;
+  QCOMPARE ( Decode ( Contents ( name ) ) , text               ) ;
+}
+
+void tst_Append::emptyData(void)
+{
+  QTemporaryDir dir                                               ;
+  QString       name = dir . path ( ) + "/empty.bz2"              ;
+  QByteArray    text = Sample ( 10000 , 5 )                       ;
+  QVERIFY  ( SaveBZip2 ( name , text )                          ) ;
+  QByteArray    before = Contents ( name )                        ;
+  QVERIFY  ( ! AppendBZip2 ( name , QByteArray ( ) )            ) ;
+  QCOMPARE ( Contents ( name ) , before                         ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Append)
+#include "tst_append.moc"
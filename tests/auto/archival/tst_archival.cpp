@@ -0,0 +1,83 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Archival : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void offByDefault     ( void ) ;
+    void standardStream   ( void ) ;
+    void threadsIdentical ( void ) ;
+    void mixedContent     ( void ) ;
+} ;
+
+// small integers in a skewed distribution , like a table of counters
+static QByteArray Records(int bytes,quint32 seed)
+{
+  QByteArray s                                 ;
+  while ( s . size ( ) < bytes )               {
+    seed = seed * 1103515245u + 12345u         ;
+    quint32 v = ( seed >> 16 ) & 0xFFFF        ;
+    s . append ( (char) ( v % 7 )            ) ;
+    s . append ( (char) ( ( v >> 3 ) & 0x1F ) ) ;
+    s . append ( (char) 0                    ) ;
+    s . append ( (char) ( v >> 12 )          ) ;
+  }                                            ;
+  s . resize ( bytes )                         ;
+  return s                                     ;
+}
+
+static QVariantMap Archival(int threads)
+{
+  QVariantMap o                 ;
+  o [ "Archival" ] = true       ;
+  o [ "Threads"  ] = threads    ;
+  return o                      ;
+}
+
+void tst_Archival::offByDefault(void)
+{
+  QByteArray  text = Sample ( 400000 , 1 )                        ;
+  QVariantMap off                                                 ;
+  off [ "Archival" ] = false                                      ;
+  QCOMPARE ( Compress ( text , 9 , off ) , Compress ( text , 9 ) ) ;
+}
+
+// archives decode with the stock decoder and the container checks pass
+void tst_Archival::standardStream(void)
+{
+  QByteArray        text  = Sample ( 700000 , 2 )                 ;
+  QByteArray        bzip2 = Compress ( text , 9 , Archival ( 1 ) ) ;
+  QByteArray        body                                          ;
+  QList<QByteArray> pieces                                        ;
+  QVERIFY  ( bzip2 . startsWith ( "BZh9" )                      ) ;
+  QVERIFY  ( FromBZip2 ( bzip2 , body )                         ) ;
+  QCOMPARE ( body , text                                        ) ;
+  QVERIFY  ( SplitBZip2 ( bzip2 , pieces )                      ) ;
+  QVERIFY  ( bzip2 . size ( ) <= Compress ( text , 9 ) . size ( ) ) ;
+}
+
+// the trials are independent , running them side by side changes nothing
+void tst_Archival::threadsIdentical(void)
+{
+  QByteArray text   = Sample ( 500000 , 3 ) + Records ( 300000 , 4 ) ;
+  QByteArray serial = Compress ( text , 9 , Archival ( 1 ) )      ;
+  QCOMPARE ( Compress ( text , 9 , Archival ( 4 ) ) , serial    ) ;
+}
+
+// a block cut where text turns into records pays for itself
+void tst_Archival::mixedContent(void)
+{
+  QByteArray text  = Sample  ( 300000 , 5 ) + Records ( 300000 , 6 ) + Sample ( 200000 , 7 ) ;
+  QByteArray plain = Compress ( text , 9 )                        ;
+  QByteArray small = Compress ( text , 9 , Archival ( 1 ) )       ;
+  QByteArray body                                                 ;
+  QVERIFY  ( small . size ( ) < plain . size ( )                ) ;
+  QVERIFY  ( FromBZip2 ( small , body )                         ) ;
+  QCOMPARE ( body , text                                        ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Archival)
+#include "tst_archival.moc"
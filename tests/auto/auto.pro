@@ -1 +1,21 @@
 TEMPLATE = subdirs
+
+SUBDIRS += $${PWD}/flush
+SUBDIRS += $${PWD}/mergesplit
+SUBDIRS += $${PWD}/sort
+SUBDIRS += $${PWD}/multistream
+SUBDIRS += $${PWD}/limits
+SUBDIRS += $${PWD}/pipeline
+SUBDIRS += $${PWD}/memory
+SUBDIRS += $${PWD}/scheduler
+SUBDIRS += $${PWD}/archival
+SUBDIRS += $${PWD}/bailout
+SUBDIRS += $${PWD}/scatter
+SUBDIRS += $${PWD}/sizehint
+SUBDIRS += $${PWD}/recover
+SUBDIRS += $${PWD}/append
+SUBDIRS += $${PWD}/compressinto
+SUBDIRS += $${PWD}/bitwriter
+SUBDIRS += $${PWD}/hugepages
+SUBDIRS += $${PWD}/contiguous
+SUBDIRS += $${PWD}/speed
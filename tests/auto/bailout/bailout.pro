@@ -0,0 +1,17 @@
+QT             = core
+QT            -= gui
+QT            += testlib
+QT            += QtBZip2
+
+CONFIG        += testcase
+CONFIG        += console
+
+TARGET         = tst_bailout
+
+TEMPLATE       = app
+
+INCLUDEPATH   += $${PWD}/../shared
+
+HEADERS       += $${PWD}/../shared/samples.h
+
+SOURCES       += $${PWD}/tst_bailout.cpp
@@ -0,0 +1,178 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Bailout : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void estimateRatio   ( void ) ;
+    void randomInput     ( void ) ;
+    void textInput       ( void ) ;
+    void deviceInput     ( void ) ;
+    void fragmentedInput ( void ) ;
+    void sectionInput    ( void ) ;
+    void compressInto    ( void ) ;
+} ;
+
+static QVariantList Bailout(double ratio)
+{
+  QVariantList v                          ;
+  QVariantMap  o                          ;
+  o [ "Bailout" ] = ratio                 ;
+  v << 9 << 30 << o                       ;
+  return v                                ;
+}
+
+void tst_Bailout::estimateRatio(void)
+{
+  QByteArray text  = Sample ( 500000 , 1 )                        ;
+  QByteArray noise = Noise  ( 500000 , 2 )                        ;
+  double     t     = BZip2EstimateRatio ( text  . constData ( ) , text  . size ( ) ) ;
+  double     r     = BZip2EstimateRatio ( noise . constData ( ) , noise . size ( ) ) ;
+  QVERIFY  ( t < 0.6                                            ) ;
+  QVERIFY  ( r > 0.95                                           ) ;
+  QVERIFY  ( r <= 1.0                                           ) ;
+  // short inputs are scanned whole
+  r = BZip2EstimateRatio ( noise . constData ( ) , 1000 )         ;
+  QVERIFY  ( r > 0.9                                            ) ;
+  QCOMPARE ( BZip2EstimateRatio ( NULL , 100 ) , 1.0            ) ;
+  QCOMPARE ( BZip2EstimateRatio ( text . constData ( ) , 0 ) , 1.0 ) ;
+}
+
+// nothing is consumed , the next call compresses regardless
+void tst_Bailout::randomInput(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray noise = Noise ( 300000 , 3 )                         ;
+  QByteArray bzip2                                                ;
+  QByteArray tail                                                 ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( noise , bzip2 ) , BZ_INCOMPRESSIBLE ) ;
+  QVERIFY  ( bzip2 . isEmpty ( )                                ) ;
+  QCOMPARE ( L . doCompress ( noise , bzip2 ) , BZ_OK           ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( Decode ( bzip2 + tail ) , noise                    ) ;
+}
+
+void tst_Bailout::textInput(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray text = Sample ( 300000 , 4 )                         ;
+  QByteArray bzip2                                                ;
+  QByteArray tail                                                 ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( text , bzip2 ) , BZ_OK            ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( bzip2 + tail , Compress ( text , 9 )               ) ;
+}
+
+// the device is probed through peek ( ) , not a byte of it is read
+void tst_Bailout::deviceInput(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray noise = Noise ( 3 << 20 , 5 )                        ;
+  QByteArray text  = Sample ( 3 << 20 , 6 )                       ;
+  QByteArray bzip2                                                ;
+  QBuffer    source ( &noise )                                    ;
+  QBuffer    target ( &bzip2 )                                    ;
+  QVERIFY  ( source . open ( QIODevice::ReadOnly  )             ) ;
+  QVERIFY  ( target . open ( QIODevice::WriteOnly )             ) ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( source , target ) , BZ_INCOMPRESSIBLE ) ;
+  QCOMPARE ( source . pos ( ) , (qint64) 0                      ) ;
+  QVERIFY  ( bzip2 . isEmpty ( )                                ) ;
+  L . CompressDone ( target )                                     ;
+  L . CleanUp ( )                                                 ;
+  QBuffer    words ( &text )                                      ;
+  bzip2 . clear ( )                                               ;
+  QVERIFY  ( words  . open ( QIODevice::ReadOnly  )             ) ;
+  QVERIFY  ( target . open ( QIODevice::WriteOnly )             ) ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( words , target ) , BZ_OK          ) ;
+  QCOMPARE ( L . CompressDone ( target ) , BZ_OK                ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( Decode ( bzip2 ) , text                            ) ;
+}
+
+// a compressible first fragment does not hide the noise behind it
+void tst_Bailout::fragmentedInput(void)
+{
+  QtBZip2           L                                             ;
+  QByteArray        head  = Sample (   2000 , 7 )                 ;
+  QByteArray        noise = Noise  ( 400000 , 8 )                 ;
+  QByteArray        text  = Sample ( 400000 , 9 )                 ;
+  QList<QByteArray> list                                          ;
+  QByteArray        bzip2                                         ;
+  QByteArray        tail                                          ;
+  BZip2Span         spans [ 3 ]                                   ;
+  list << head << noise . left ( 1000 ) << noise                  ;
+  spans [ 0 ] . data = head  . data ( )                           ;
+  spans [ 0 ] . size = head  . size ( )                           ;
+  spans [ 1 ] . data = noise . data ( )                           ;
+  spans [ 1 ] . size = 1000                                       ;
+  spans [ 2 ] . data = noise . data ( )                           ;
+  spans [ 2 ] . size = noise . size ( )                           ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( list , bzip2 ) , BZ_INCOMPRESSIBLE ) ;
+  L . CompressDone ( tail )                                       ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( spans , 3 , bzip2 ) , BZ_INCOMPRESSIBLE ) ;
+  L . CompressDone ( tail )                                       ;
+  L . CleanUp ( )                                                 ;
+  // text behind the same head compresses and round-trips
+  list . clear ( )                                                ;
+  list << head << text                                            ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doCompress ( list , bzip2 ) , BZ_OK            ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( Decode ( bzip2 + tail ) , head + text              ) ;
+}
+
+void tst_Bailout::sectionInput(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray noise = Noise ( 200000 , 10 )                        ;
+  QByteArray rest  = noise                                        ;
+  QByteArray part                                                 ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  QCOMPARE ( L . doSection ( rest , part ) , BZ_INCOMPRESSIBLE  ) ;
+  QCOMPARE ( rest , noise                                       ) ;
+  QVERIFY  ( part . isEmpty ( )                                 ) ;
+  L . CompressDone ( part )                                       ;
+  L . CleanUp ( )                                                 ;
+  QByteArray text = Sample ( 200000 , 11 )                        ;
+  QByteArray wire                                                 ;
+  rest = text                                                     ;
+  QCOMPARE ( L . BeginCompress ( Bailout ( 0.9 ) ) , BZ_OK      ) ;
+  while ( rest . size ( ) > 0 )                                   {
+    QCOMPARE ( L . doSection ( rest , part ) , BZ_OK            ) ;
+    wire . append ( part )                                        ;
+  }                                                               ;
+  QCOMPARE ( L . CompressDone ( part ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( Decode ( wire + part ) , text                      ) ;
+}
+
+void tst_Bailout::compressInto(void)
+{
+  QByteArray noise = Noise  ( 100000 , 12 )                       ;
+  QByteArray text  = Sample ( 100000 , 13 )                       ;
+  QByteArray dst ( (int) BZip2CompressBound ( 100000 ) , 0 )      ;
+  qint64     n                                                    ;
+  n = BZip2CompressInto ( dst . data ( ) , dst . size ( ) ,
+                          noise . constData ( ) , noise . size ( ) , 9 , 0.9 ) ;
+  QCOMPARE ( n , (qint64) BZ_INCOMPRESSIBLE                     ) ;
+  n = BZip2CompressInto ( dst . data ( ) , dst . size ( ) ,
+                          text . constData ( ) , text . size ( ) , 9 , 0.9 ) ;
+  QVERIFY  ( n > 0                                              ) ;
+  QCOMPARE ( Decode ( dst . left ( (int) n ) ) , text           ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Bailout)
+#include "tst_bailout.moc"
@@ -0,0 +1,93 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_BitWriter : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void nonLastFlush  ( void ) ;
+    void pipelineCarry ( void ) ;
+    void latencyFlush  ( void ) ;
+} ;
+
+// a stream interrupted by Flush calls that end blocks but not the stream
+static QByteArray Flushed(const QVariantMap & options,int level,int flushes)
+{
+  QtBZip2      L                                                  ;
+  QVariantList v                                                  ;
+  QByteArray   wire                                               ;
+  QByteArray   part                                               ;
+  v << level << 30 << options                                     ;
+  if ( L . BeginCompress ( v ) != BZ_OK ) return wire             ;
+  for (int i = 0 ; i <= flushes ; i++ )                           {
+    part . clear ( )                                              ;
+    L . doCompress ( Sample ( 90001 + i * 77777 , 20 + i ) , part ) ;
+    wire . append ( part )                                        ;
+    if ( i == flushes ) break                                     ;
+    part . clear ( )                                              ;
+    L . Flush ( part )                                            ;
+    wire . append ( part )                                        ;
+  }                                                               ;
+  part . clear ( )                                                ;
+  L . CompressDone ( part )                                       ;
+  L . CleanUp ( )                                                 ;
+  wire . append ( part )                                          ;
+  return wire                                                     ;
+}
+
+static QByteArray Expected(int flushes)
+{
+  QByteArray body                                                 ;
+  for (int i = 0 ; i <= flushes ; i++ )                           {
+    body . append ( Sample ( 90001 + i * 77777 , 20 + i ) )       ;
+  }                                                               ;
+  return body                                                     ;
+}
+
+static quint16 Checksum(const QByteArray & data)
+{
+  return qChecksum ( data . constData ( ) , data . size ( ) )     ;
+}
+
+// sizes and checksums of the archives the byte at a time bsW produced
+void tst_BitWriter::nonLastFlush(void)
+{
+  QByteArray a = Flushed ( QVariantMap ( ) , 9 , 3 )              ;
+  QByteArray b = Flushed ( QVariantMap ( ) , 1 , 2 )              ;
+  QCOMPARE ( Decode ( a ) , Expected ( 3 )                      ) ;
+  QCOMPARE ( Decode ( b ) , Expected ( 2 )                      ) ;
+  QCOMPARE ( a . size ( ) ,  98585                              ) ;
+  QCOMPARE ( b . size ( ) ,  60734                              ) ;
+  QCOMPARE ( Checksum ( a ) , (quint16) 0xd8e4                  ) ;
+  QCOMPARE ( Checksum ( b ) , (quint16) 0x8b34                  ) ;
+}
+
+// each slot starts from the bits the previous block left over
+void tst_BitWriter::pipelineCarry(void)
+{
+  QVariantMap o                                                   ;
+  o [ "Pipeline" ] = true                                         ;
+  QByteArray  a = Flushed ( o , 1 , 2 )                           ;
+  QByteArray  c = Compress ( Sample ( 900000 , 30 ) , 1 , o , 65536 ) ;
+  QCOMPARE ( a , Flushed ( QVariantMap ( ) , 1 , 2 )            ) ;
+  QCOMPARE ( Decode ( c ) , Sample ( 900000 , 30 )              ) ;
+  QCOMPARE ( c . size ( ) , 108681                              ) ;
+  QCOMPARE ( Checksum ( c ) , (quint16) 0xa869                  ) ;
+}
+
+// LatencyBytes ends a stream whenever that much input is pending
+void tst_BitWriter::latencyFlush(void)
+{
+  QVariantMap o                                                   ;
+  o [ "LatencyBytes" ] = 50000                                    ;
+  QByteArray  text = Sample ( 400000 , 40 )                       ;
+  QByteArray  d    = Compress ( text , 9 , o , 30000 )            ;
+  QCOMPARE ( Decode ( d ) , text                                ) ;
+  QCOMPARE ( d . size ( ) ,  49213                              ) ;
+  QCOMPARE ( Checksum ( d ) , (quint16) 0x8be8                  ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_BitWriter)
+#include "tst_bitwriter.moc"
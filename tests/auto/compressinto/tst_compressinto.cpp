@@ -0,0 +1,80 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_CompressInto : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void withinBound   ( void ) ;
+    void exactCapacity ( void ) ;
+    void shortCapacity ( void ) ;
+    void badParameters ( void ) ;
+} ;
+
+static qint64 Into(QByteArray & dst,qint64 capacity,const QByteArray & src,int level)
+{
+  return BZip2CompressInto ( dst . data ( ) , capacity ,
+                             src . constData ( ) , src . size ( ) , level , 0 ) ;
+}
+
+// noise is the worst case the bound has to hold
+void tst_CompressInto::withinBound(void)
+{
+  QByteArray inputs [ 3 ] = { QByteArray ( ) , Sample ( 250000 , 1 ) , Noise ( 250000 , 2 ) } ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QByteArray dst ( (int) BZip2CompressBound ( inputs [ i ] . size ( ) ) , 0 ) ;
+    qint64     n   = Into ( dst , dst . size ( ) , inputs [ i ] , 9 ) ;
+    QVERIFY  ( n > 0                                            ) ;
+    QCOMPARE ( Decode ( dst . left ( (int) n ) ) , inputs [ i ] ) ;
+  }                                                               ;
+}
+
+void tst_CompressInto::exactCapacity(void)
+{
+  int sizes [ 3 ] = { 1000 , 180000 , 600000 }                    ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QByteArray text      = Sample ( sizes [ i ] , 3 + i )         ;
+    QByteArray reference = Compress ( text , 1 )                  ;
+    QByteArray dst ( reference . size ( ) + 1 , '#' )             ;
+    qint64     n         = Into ( dst , reference . size ( ) , text , 1 ) ;
+    QCOMPARE ( n , (qint64) reference . size ( )                ) ;
+    QCOMPARE ( dst . left ( (int) n ) , reference               ) ;
+    QCOMPARE ( dst [ (int) n ] , '#'                            ) ;
+  }                                                               ;
+}
+
+// one byte short fails , nothing is written past the capacity
+void tst_CompressInto::shortCapacity(void)
+{
+  int sizes [ 3 ] = { 1000 , 180000 , 600000 }                    ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QByteArray text      = Sample ( sizes [ i ] , 6 + i )         ;
+    QByteArray reference = Compress ( text , 1 )                  ;
+    qint64     capacity  = reference . size ( ) - 1               ;
+    QByteArray dst ( reference . size ( ) + 1 , '#' )             ;
+    QCOMPARE ( Into ( dst , capacity , text , 1 ) , (qint64) BZ_OUTBUFF_FULL ) ;
+    QCOMPARE ( dst [ (int) capacity     ] , '#'                 ) ;
+    QCOMPARE ( dst [ (int) capacity + 1 ] , '#'                 ) ;
+  }                                                               ;
+  QByteArray dst ( 16 , '#' )                                     ;
+  QCOMPARE ( Into ( dst , 0 , Sample ( 100 , 9 ) , 9 ) , (qint64) BZ_OUTBUFF_FULL ) ;
+  QCOMPARE ( dst , QByteArray ( 16 , '#' )                      ) ;
+}
+
+void tst_CompressInto::badParameters(void)
+{
+  QByteArray text = Sample ( 1000 , 10 )                          ;
+  QByteArray dst ( 4096 , 0 )                                     ;
+  QCOMPARE ( Into ( dst , -1 , text ,  9 ) , (qint64) BZ_PARAM_ERROR ) ;
+  QCOMPARE ( Into ( dst , dst . size ( ) , text ,  0 ) , (qint64) BZ_PARAM_ERROR ) ;
+  QCOMPARE ( Into ( dst , dst . size ( ) , text , 10 ) , (qint64) BZ_PARAM_ERROR ) ;
+  QCOMPARE ( BZip2CompressInto ( NULL , 4096 , text . constData ( ) , text . size ( ) , 9 , 0 ) ,
+             (qint64) BZ_PARAM_ERROR                            ) ;
+  QCOMPARE ( BZip2CompressInto ( dst . data ( ) , 4096 , NULL , 10 , 9 , 0 ) ,
+             (qint64) BZ_PARAM_ERROR                            ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_CompressInto)
+#include "tst_compressinto.moc"
@@ -0,0 +1,121 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Contiguous : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void validInput     ( void ) ;
+    void corruptedInput ( void ) ;
+    void truncatedInput ( void ) ;
+    void badBlockMagic  ( void ) ;
+} ;
+
+typedef struct        {
+  int           rc      ;
+  QByteArray    body    ;
+  QList<qint64> totalIn ;
+} Outcome             ;
+
+// decodes in feeds of the given size , 0 for all at once ; totalIn holds
+// the input consumed when each stream ended
+static Outcome Feed(const QByteArray & bzip2,int piece)
+{
+  QtBZip2    L                                                    ;
+  QByteArray part                                                 ;
+  Outcome    o                                                    ;
+  o . rc = L . BeginDecompress ( )                                ;
+  if ( piece <= 0 ) piece = bzip2 . size ( )                      ;
+  for (int at = 0 ; at < bzip2 . size ( ) ; at += piece )         {
+    part . clear ( )                                              ;
+    o . rc = L . doDecompress ( bzip2 . mid ( at , piece ) , part ) ;
+    o . body . append ( part )                                    ;
+    if ( o . rc < 0 ) break                                       ;
+  }                                                               ;
+  QVariantList streams = L . Streams ( )                          ;
+  for (int i = 0 ; i < streams . count ( ) ; i++ )                {
+    QVariantMap V = streams [ i ] . toMap ( )                     ;
+    o . totalIn << V [ "Input" ] . toLongLong ( ) + V [ "Compressed" ] . toLongLong ( ) ;
+  }                                                               ;
+  L . DecompressDone ( )                                          ;
+  return o                                                        ;
+}
+
+// feeds below BZ_CONTIGUOUS_MIN ( 64 bytes ) take the byte at a time
+// machine , the whole archive takes the contiguous one ; every feed must
+// end with the same status , output and stream offsets as the whole
+static void Agree(const QByteArray & bzip2,const Outcome & whole)
+{
+  int     pieces [ 4 ] = { 1 , 7 , 13 , 63 }                      ;
+  for (int i = 0 ; i < 4 ; i++ )                                  {
+    Outcome fed = Feed ( bzip2 , pieces [ i ] )                   ;
+    QCOMPARE ( fed . rc      , whole . rc                       ) ;
+    QCOMPARE ( fed . body    , whole . body                     ) ;
+    QCOMPARE ( fed . totalIn , whole . totalIn                  ) ;
+  }                                                               ;
+}
+
+static QByteArray Archive(QByteArray & body)
+{
+  QByteArray a = Sample ( 250000 , 1 )                            ;
+  QByteArray b = Sample (  30000 , 2 ) + Noise ( 2000 , 3 )       ;
+  body = a + b                                                    ;
+  return Compress ( a , 1 ) + Compress ( b , 9 )                  ;
+}
+
+void tst_Contiguous::validInput(void)
+{
+  QByteArray body                                                 ;
+  QByteArray bzip2 = Archive ( body )                             ;
+  Outcome    whole = Feed ( bzip2 , 0 )                           ;
+  QCOMPARE ( whole . body , body                                ) ;
+  QCOMPARE ( whole . totalIn . count ( ) , 2                    ) ;
+  QCOMPARE ( whole . totalIn [ 0 ] ,
+             (qint64) Compress ( Sample ( 250000 , 1 ) , 1 ) . size ( ) ) ;
+  QCOMPARE ( whole . totalIn [ 1 ] , (qint64) bzip2 . size ( )  ) ;
+  QCOMPARE ( whole . rc , BZ_STREAM_END                        ) ;
+  Agree    ( bzip2 , whole                                       ) ;
+}
+
+// a flipped byte in the second stream , the first stays complete
+void tst_Contiguous::corruptedInput(void)
+{
+  QByteArray body                                                 ;
+  QByteArray bzip2 = Archive ( body )                             ;
+  int        first = Compress ( Sample ( 250000 , 1 ) , 1 ) . size ( ) ;
+  int        at    = first + ( bzip2 . size ( ) - first ) / 2     ;
+  bzip2 [ at ] = (char) ( bzip2 [ at ] ^ 0x20 )                   ;
+  Outcome    whole = Feed ( bzip2 , 0 )                           ;
+  QVERIFY  ( whole . rc < 0                                     ) ;
+  QCOMPARE ( whole . totalIn . count ( ) , 1                    ) ;
+  QVERIFY  ( whole . body . startsWith ( body . left ( 250000 ) ) ) ;
+  Agree    ( bzip2 , whole                                       ) ;
+}
+
+void tst_Contiguous::truncatedInput(void)
+{
+  QByteArray body                                                 ;
+  QByteArray bzip2 = Archive ( body )                             ;
+  bzip2 . chop ( 100 )                                            ;
+  Outcome    whole = Feed ( bzip2 , 0 )                           ;
+  QCOMPARE ( whole . rc , BZ_OK                                 ) ;
+  QVERIFY  ( whole . body . size ( ) >= 250000                  ) ;
+  QVERIFY  ( body . startsWith ( whole . body )                 ) ;
+  Agree    ( bzip2 , whole                                       ) ;
+}
+
+void tst_Contiguous::badBlockMagic(void)
+{
+  QByteArray body                                                 ;
+  QByteArray bzip2 = Archive ( body )                             ;
+  bzip2 [ 6 ] = (char) ( bzip2 [ 6 ] ^ 0x01 )                     ;
+  Outcome    whole = Feed ( bzip2 , 0 )                           ;
+  QCOMPARE ( whole . rc , BZ_DATA_ERROR                         ) ;
+  QVERIFY  ( whole . body . isEmpty ( )                         ) ;
+  Agree    ( bzip2 , whole                                       ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Contiguous)
+#include "tst_contiguous.moc"
@@ -0,0 +1,14 @@
+QT             = core
+QT            -= gui
+QT            += network
+QT            += testlib
+QT            += QtBZip2
+
+CONFIG        += testcase
+CONFIG        += console
+
+TARGET         = tst_flush
+
+TEMPLATE       = app
+
+SOURCES       += $${PWD}/tst_flush.cpp
@@ -0,0 +1,150 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtNetwork>
+#include <QtBZip2>
+
+class tst_Flush : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void sectionSyncFlush ( void ) ;
+    void rangeSyncFlush   ( void ) ;
+    void emptySyncFlush   ( void ) ;
+    void latencyBytes     ( void ) ;
+    void socketStream     ( void ) ;
+} ;
+
+static QByteArray Decode(const QByteArray & data,int * rc)
+{
+  QtBZip2    L                             ;
+  QByteArray body                          ;
+  *rc = L . BeginDecompress ( )            ;
+  if ( ! L . IsCorrect ( *rc ) ) return body ;
+  *rc = L . doDecompress ( data , body )   ;
+  L . DecompressDone ( )                   ;
+  return body                              ;
+}
+
+static QByteArray Sample(int lines)
+{
+  QByteArray s                                                  ;
+  for (int i = 0 ; i < lines ; i++ )                            {
+    s . append ( QByteArray ( "line " ) + QByteArray::number(i) ) ;
+    s . append ( " of the flush sample\n"                       ) ;
+  }                                                             ;
+  return s                                                      ;
+}
+
+// input fed through doSection must be decodable after a sync flush
+void tst_Flush::sectionSyncFlush(void)
+{
+  QtBZip2    L                                       ;
+  QByteArray source = Sample ( 200 )                 ;
+  QByteArray rest   = source                         ;
+  QByteArray part                                    ;
+  QByteArray wire                                    ;
+  int        rc                                      ;
+  QCOMPARE ( L . BeginCompress ( 9 , 30 ) , BZ_OK  ) ;
+  while ( rest . size ( ) > 0 )                      {
+    QVERIFY ( L . IsCorrect ( L . doSection ( rest , part ) ) ) ;
+    wire . append ( part )                           ;
+  }                                                  ;
+  QCOMPARE ( L . Flush ( part , true ) , BZ_OK     ) ;
+  QVERIFY  ( part . size ( ) > 0                   ) ;
+  wire . append ( part )                             ;
+  QCOMPARE ( Decode ( wire , &rc ) , source        ) ;
+  QCOMPARE ( rc , BZ_STREAM_END                    ) ;
+  L . CompressDone ( part )                          ;
+  L . CleanUp      (      )                          ;
+}
+
+void tst_Flush::rangeSyncFlush(void)
+{
+  QtBZip2    L                                       ;
+  QByteArray first  = Sample ( 300 )                 ;
+  QByteArray second = Sample (  50 )                 ;
+  QByteArray part                                    ;
+  QByteArray wire                                    ;
+  int        rc                                      ;
+  QCOMPARE ( L . BeginCompress ( 9 , 30 ) , BZ_OK  ) ;
+  QCOMPARE ( L . doCompress ( first , part ) , BZ_OK ) ;
+  wire . append ( part )                             ;
+  QCOMPARE ( L . Flush ( part , true ) , BZ_OK     ) ;
+  wire . append ( part )                             ;
+  // everything written so far decodes before the stream is finished
+  QCOMPARE ( Decode ( wire , &rc ) , first         ) ;
+  QCOMPARE ( L . doCompress ( second , part ) , BZ_OK ) ;
+  wire . append ( part )                             ;
+  QCOMPARE ( L . CompressDone ( part ) , BZ_OK     ) ;
+  wire . append ( part )                             ;
+  QCOMPARE ( Decode ( wire , &rc ) , first + second ) ;
+  L . CleanUp ( )                                    ;
+}
+
+void tst_Flush::emptySyncFlush(void)
+{
+  QtBZip2    L                                       ;
+  QByteArray part                                    ;
+  QCOMPARE ( L . BeginCompress ( 9 , 30 ) , BZ_OK  ) ;
+  QCOMPARE ( L . Flush ( part , true ) , BZ_OK     ) ;
+  QCOMPARE ( part . size ( ) , 0                   ) ;
+  L . CompressDone ( part )                          ;
+  L . CleanUp      (      )                          ;
+}
+
+// LatencyBytes flushes on its own , no explicit Flush needed
+void tst_Flush::latencyBytes(void)
+{
+  QtBZip2      L                                     ;
+  QVariantList v                                     ;
+  QVariantMap  o                                     ;
+  QByteArray   source = Sample ( 400 )               ;
+  QByteArray   wire                                  ;
+  int          rc                                    ;
+  o [ "LatencyBytes" ] = 1024                        ;
+  v << 9 << 30 << o                                  ;
+  QCOMPARE ( L . BeginCompress ( v ) , BZ_OK       ) ;
+  QCOMPARE ( L . doCompress ( source , wire ) , BZ_OK ) ;
+  QByteArray body = Decode ( wire , &rc )            ;
+  QVERIFY  ( body . size ( ) > source . size ( ) - 1024 ) ;
+  QCOMPARE ( body , source . left ( body . size ( ) ) ) ;
+  QByteArray tail                                    ;
+  L . CompressDone ( tail )                          ;
+  L . CleanUp      (      )                          ;
+}
+
+// a receiver on a socket sees each message as soon as the sender flushes
+void tst_Flush::socketStream(void)
+{
+  QTcpServer server                                              ;
+  QTcpSocket client                                              ;
+  QVERIFY  ( server . listen ( QHostAddress::LocalHost , 0 )   ) ;
+  client . connectToHost ( QHostAddress::LocalHost , server . serverPort ( ) ) ;
+  QVERIFY  ( client . waitForConnected ( 5000 )                ) ;
+  QVERIFY  ( server . waitForNewConnection ( 5000 )            ) ;
+  QTcpSocket * peer = server . nextPendingConnection ( )         ;
+  QVERIFY  ( peer != NULL                                      ) ;
+  QtBZip2Device sender   ( &client )                             ;
+  QtBZip2Device receiver ( peer    )                             ;
+  QVERIFY  ( sender   . open ( QIODevice::WriteOnly )          ) ;
+  QVERIFY  ( receiver . open ( QIODevice::ReadOnly  )          ) ;
+  for (int i = 0 ; i < 3 ; i++ )                                 {
+    QByteArray message = Sample ( 20 + i * 50 )                  ;
+    QByteArray got                                               ;
+    QCOMPARE ( sender . write ( message ) , (qint64) message . size ( ) ) ;
+    QVERIFY  ( sender . flush ( )                              ) ;
+    client . waitForBytesWritten ( 5000 )                        ;
+    while ( got . size ( ) < message . size ( ) )                {
+      got . append ( receiver . readAll ( ) )                    ;
+      if ( got . size ( ) >= message . size ( ) ) break          ;
+      if ( ! peer -> waitForReadyRead ( 5000 ) ) break           ;
+    }                                                            ;
+    QCOMPARE ( got , message                                   ) ;
+  }                                                              ;
+  sender   . close ( )                                           ;
+  receiver . close ( )                                           ;
+  delete peer                                                    ;
+}
+
+QTEST_GUILESS_MAIN(tst_Flush)
+#include "tst_flush.moc"
@@ -0,0 +1,99 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+#if defined(Q_OS_LINUX)
+#include <sys/prctl.h>
+#endif
+
+class tst_HugePages : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void processWide ( void ) ;
+    void perStream   ( void ) ;
+    void unavailable ( void ) ;
+} ;
+
+static qint64 Stat(const char * key)
+{
+  return BZip2HugePageStats ( ) [ key ] . toLongLong ( )          ;
+}
+
+// every request is either mapped or falls back , and all of it returns
+static void Balanced(qint64 requests,qint64 mapped,qint64 fallbacks)
+{
+  QVERIFY  ( Stat ( "Requests" ) > requests                     ) ;
+  QCOMPARE ( Stat ( "Requests" ) - requests                       ,
+             ( Stat ( "Mapped" ) - mapped ) + ( Stat ( "Fallbacks" ) - fallbacks ) ) ;
+  QCOMPARE ( Stat ( "Live"  ) , (qint64) 0                      ) ;
+  QCOMPARE ( Stat ( "Bytes" ) , (qint64) 0                      ) ;
+}
+
+void tst_HugePages::processWide(void)
+{
+  QByteArray text      = Sample ( 1500000 , 1 )                   ;
+  QByteArray reference = Compress ( text , 9 )                    ;
+  qint64     requests  = Stat ( "Requests"  )                     ;
+  qint64     mapped    = Stat ( "Mapped"    )                     ;
+  qint64     fallbacks = Stat ( "Fallbacks" )                     ;
+  BZip2SetHugePages ( true  )                                     ;
+  QVERIFY  ( BZip2HugePageStats ( ) [ "Enabled" ] . toBool ( )  ) ;
+  QByteArray bzip2     = Compress ( text , 9 )                    ;
+  QByteArray body                                                 ;
+  QCOMPARE ( Decode ( bzip2 , body ) , BZ_STREAM_END            ) ;
+  BZip2SetHugePages ( false )                                     ;
+  QCOMPARE ( bzip2 , reference                                  ) ;
+  QCOMPARE ( body  , text                                       ) ;
+  Balanced ( requests , mapped , fallbacks                       ) ;
+}
+
+void tst_HugePages::perStream(void)
+{
+  QByteArray text      = Sample ( 1200000 , 2 )                   ;
+  QByteArray reference = Compress ( text , 9 )                    ;
+  qint64     requests  = Stat ( "Requests"  )                     ;
+  qint64     mapped    = Stat ( "Mapped"    )                     ;
+  qint64     fallbacks = Stat ( "Fallbacks" )                     ;
+  QtBZip2    L                                                    ;
+  QByteArray bzip2                                                ;
+  QByteArray tail                                                 ;
+  L . setHugePages ( true )                                       ;
+  QCOMPARE ( L . BeginCompress ( 9 , 30 ) , BZ_OK               ) ;
+  QCOMPARE ( L . doCompress ( text , bzip2 ) , BZ_OK            ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( bzip2 + tail , reference                           ) ;
+  Balanced ( requests , mapped , fallbacks                       ) ;
+}
+
+// with transparent huge pages switched off for the process the mappings
+// are plain pages ; the streams are the same and nothing leaks
+void tst_HugePages::unavailable(void)
+{
+#if defined(Q_OS_LINUX) && defined(PR_SET_THP_DISABLE)
+  QVERIFY  ( ::prctl ( PR_SET_THP_DISABLE , 1 , 0 , 0 , 0 ) == 0 ) ;
+  QByteArray text      = Sample ( 2000000 , 3 )                   ;
+  QByteArray reference = Compress ( text , 9 )                    ;
+  qint64     requests  = Stat ( "Requests"  )                     ;
+  qint64     mapped    = Stat ( "Mapped"    )                     ;
+  qint64     fallbacks = Stat ( "Fallbacks" )                     ;
+  qint64     anon      = Stat ( "AnonHugePages" )                 ;
+  QByteArray bzip2                                                ;
+  QByteArray body                                                 ;
+  BZip2SetHugePages ( true  )                                     ;
+  bzip2 = Compress ( text , 9 )                                   ;
+  QCOMPARE ( Decode ( bzip2 , body ) , BZ_STREAM_END            ) ;
+  QVERIFY  ( Stat ( "AnonHugePages" ) <= anon                   ) ;
+  BZip2SetHugePages ( false )                                     ;
+  ::prctl ( PR_SET_THP_DISABLE , 0 , 0 , 0 , 0 )                  ;
+  QCOMPARE ( bzip2 , reference                                  ) ;
+  QCOMPARE ( body  , text                                       ) ;
+  Balanced ( requests , mapped , fallbacks                       ) ;
+#else
+  QSKIP ( "needs PR_SET_THP_DISABLE" ) ;
+#endif
+}
+
+QTEST_GUILESS_MAIN(tst_HugePages)
+#include "tst_hugepages.moc"
@@ -0,0 +1,157 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Limits : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void outputCutoff    ( void ) ;
+    void ratioCutoff     ( void ) ;
+    void blockCutoff     ( void ) ;
+    void generousLimits  ( void ) ;
+    void stickyError     ( void ) ;
+    void pipelinedCutoff ( void ) ;
+    void trailingGarbage ( void ) ;
+} ;
+
+void tst_Limits::outputCutoff(void)
+{
+  QByteArray  zeros ( 20 << 20 , 0 )                              ;
+  QByteArray  bomb = Compress ( zeros , 9 )                       ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  int         rc                                                  ;
+  QVERIFY  ( bomb . size ( ) < 1024                             ) ;
+  L [ "MaxOutput" ] = 1 << 20                                     ;
+  body = BZip2Uncompress ( bomb , L , &rc )                       ;
+  QCOMPARE ( rc , BZ_LIMIT_EXCEEDED                             ) ;
+  QCOMPARE ( body , zeros . left ( 1 << 20 )                    ) ;
+  // a limit equal to the real size is not a violation
+  L [ "MaxOutput" ] = zeros . size ( )                            ;
+  body = BZip2Uncompress ( bomb , L , &rc )                       ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( body , zeros                                       ) ;
+  L [ "MaxOutput" ] = zeros . size ( ) - 1                        ;
+  body = BZip2Uncompress ( bomb , L , &rc )                       ;
+  QCOMPARE ( rc , BZ_LIMIT_EXCEEDED                             ) ;
+  QCOMPARE ( body . size ( ) , zeros . size ( ) - 1             ) ;
+  QCOMPARE ( Decode ( bomb , body , L , 4096 ) , BZ_LIMIT_EXCEEDED ) ;
+  QCOMPARE ( body . size ( ) , zeros . size ( ) - 1             ) ;
+}
+
+void tst_Limits::ratioCutoff(void)
+{
+  QByteArray  zeros ( 20 << 20 , 0 )                              ;
+  QByteArray  bomb = Compress ( zeros , 9 )                       ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  int         rc                                                  ;
+  L [ "MaxRatio" ] = 100                                          ;
+  body = BZip2Uncompress ( bomb , L , &rc )                       ;
+  QCOMPARE ( rc , BZ_LIMIT_EXCEEDED                             ) ;
+  QVERIFY  ( body . size ( ) < zeros . size ( )                 ) ;
+  QCOMPARE ( Decode ( bomb , body , L , 4096 ) , BZ_LIMIT_EXCEEDED ) ;
+  QVERIFY  ( body . size ( ) < zeros . size ( )                 ) ;
+}
+
+void tst_Limits::blockCutoff(void)
+{
+  QByteArray  text = Sample ( 500000 , 1 )                        ;
+  QByteArray  bzip2 = Compress ( text , 1 )                       ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  int         rc                                                  ;
+  L [ "MaxBlocks" ] = 2                                           ;
+  body = BZip2Uncompress ( bzip2 , L , &rc )                      ;
+  QCOMPARE ( rc , BZ_LIMIT_EXCEEDED                             ) ;
+  QVERIFY  ( body . size ( ) <= 200000                          ) ;
+  QCOMPARE ( body , text . left ( body . size ( ) )             ) ;
+  L [ "MaxBlocks" ] = 6                                           ;
+  body = BZip2Uncompress ( bzip2 , L , &rc )                      ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( body , text                                        ) ;
+}
+
+void tst_Limits::generousLimits(void)
+{
+  QByteArray  text = Sample ( 500000 , 2 )                        ;
+  QByteArray  bzip2 = Compress ( text , 9 )                       ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  int         rc                                                  ;
+  L [ "MaxOutput" ] = 1 << 30                                     ;
+  L [ "MaxRatio"  ] = 50                                          ;
+  L [ "MaxBlocks" ] = 1000                                        ;
+  L [ "MaxMsecs"  ] = 600000                                      ;
+  body = BZip2Uncompress ( bzip2 , L , &rc )                      ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( body , text                                        ) ;
+  QCOMPARE ( Decode ( bzip2 , body , L , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , text                                        ) ;
+}
+
+// once a limit is hit every later call reports it again
+void tst_Limits::stickyError(void)
+{
+  QByteArray   zeros ( 4 << 20 , 0 )                              ;
+  QByteArray   bomb = Compress ( zeros , 9 )                      ;
+  QtBZip2      L                                                  ;
+  QVariantList v                                                  ;
+  QVariantMap  o                                                  ;
+  QByteArray   body                                               ;
+  o [ "MaxOutput" ] = 1000                                        ;
+  v << o                                                          ;
+  QCOMPARE ( L . BeginDecompress ( v ) , BZ_OK                  ) ;
+  QCOMPARE ( L . doDecompress ( bomb , body ) , BZ_LIMIT_EXCEEDED ) ;
+  QCOMPARE ( body . size ( ) , 1000                             ) ;
+  QCOMPARE ( L . doDecompress ( bomb , body ) , BZ_LIMIT_EXCEEDED ) ;
+  QCOMPARE ( body . size ( ) , 1000                             ) ;
+  L . DecompressDone ( )                                          ;
+}
+
+// the pipelined decoder may stop short , but never past the limit
+void tst_Limits::pipelinedCutoff(void)
+{
+  QByteArray  zeros ( 20 << 20 , 0 )                              ;
+  QByteArray  bomb  = Compress ( zeros , 9 )                      ;
+  QByteArray  text  = Sample ( 500000 , 3 )                       ;
+  QByteArray  bzip2 = Compress ( text , 1 )                       ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  L [ "Pipeline"  ] = true                                        ;
+  L [ "MaxOutput" ] = 5 << 20                                     ;
+  QCOMPARE ( Decode ( bomb , body , L , 4096 ) , BZ_LIMIT_EXCEEDED ) ;
+  QVERIFY  ( body . size ( ) <= ( 5 << 20 )                     ) ;
+  QCOMPARE ( body , zeros . left ( body . size ( ) )            ) ;
+  L . remove ( "MaxOutput" )                                      ;
+  L [ "MaxBlocks" ] = 2                                           ;
+  QCOMPARE ( Decode ( bzip2 , body , L , 4096 ) , BZ_LIMIT_EXCEEDED ) ;
+  QCOMPARE ( body , text . left ( body . size ( ) )             ) ;
+  L [ "MaxBlocks" ] = 6                                           ;
+  QCOMPARE ( Decode ( bzip2 , body , L , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , text                                        ) ;
+}
+
+// bytes after a complete stream are ignored , limits or not
+void tst_Limits::trailingGarbage(void)
+{
+  QByteArray  text  = Sample ( 100000 , 4 )                       ;
+  QByteArray  bzip2 = Compress ( text , 9 ) + QByteArray ( "garbage!garbage!" ) ;
+  QVariantMap L                                                   ;
+  QByteArray  body                                                ;
+  int         rc                                                  ;
+  body = BZip2Uncompress ( bzip2 , L , &rc )                      ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( body , text                                        ) ;
+  L [ "MaxOutput" ] = text . size ( )                             ;
+  body = BZip2Uncompress ( bzip2 , L , &rc )                      ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( body , text                                        ) ;
+  QCOMPARE ( Decode ( bzip2 , body , L , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , text                                        ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Limits)
+#include "tst_limits.moc"
@@ -0,0 +1,266 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Memory : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void failPolicy      ( void ) ;
+    void degradePolicy   ( void ) ;
+    void waitPolicy      ( void ) ;
+    void streamBoundary  ( void ) ;
+    void heldCounted     ( void ) ;
+    void parkedWaiters   ( void ) ;
+    void degradeTimeout  ( void ) ;
+    void badPolicy       ( void ) ;
+} ;
+
+static qint64 Stat(const char * name)
+{
+  return BZip2MemoryStats ( ) [ name ] . toLongLong ( ) ;
+}
+
+static QVariantMap Policy(int policy)
+{
+  QVariantMap o                 ;
+  o [ "Memory" ] = policy       ;
+  return o                      ;
+}
+
+// a level 9 compressor holds about 7.5 MB , leaving no room for another
+// compressor or a level 9 decoder under a 10 MB budget
+class Holder
+{
+  public:
+    QtBZip2 L                                               ;
+    Holder  (void) { BZip2SetMemoryBudget ( 10 << 20 ) ; L . BeginCompress ( 9 , 30 ) ; }
+    ~Holder (void) { Release ( ) ; BZip2SetMemoryBudget ( 0 ) ; }
+    void Release (void) { QByteArray t ; L . CompressDone ( t ) ; L . CleanUp ( ) ; }
+}                                                           ;
+
+class Waiter : public QThread
+{
+  public:
+    QByteArray source                                       ;
+    QByteArray bzip2                                        ;
+    QAtomicInt done                                         ;
+    int        rc                                           ;
+  protected:
+    virtual void run (void)
+    {
+      rc = Compress ( source , bzip2 , 9 , Policy ( BZ_MEMORY_WAIT ) ) ;
+      done . storeRelease ( 1 )                             ;
+    }
+}                                                           ;
+
+// decodes a level 1 stream , then waits for go before a level 9 one ; the
+// level 1 reservation is still held when the second stream grows
+class Grower : public QThread
+{
+  public:
+    QByteArray small                                        ;
+    QByteArray large                                        ;
+    QByteArray body                                         ;
+    QAtomicInt held                                         ;
+    QAtomicInt go                                           ;
+    int        rc                                           ;
+  protected:
+    virtual void run (void)
+    {
+      QtBZip2      L                                        ;
+      QByteArray   part                                     ;
+      QVariantList v                                        ;
+      v << Policy ( BZ_MEMORY_WAIT )                        ;
+      L . BeginDecompress ( v )                             ;
+      rc = L . doDecompress ( small , body )                ;
+      held . storeRelease ( 1 )                             ;
+      while ( go . loadAcquire ( ) == 0 ) QThread::msleep ( 10 ) ;
+      if ( rc == BZ_STREAM_END ) rc = L . doDecompress ( large , part ) ;
+      body . append ( part )                                ;
+      L . DecompressDone ( )                                ;
+    }
+}                                                           ;
+
+static void Ready(Grower & g)
+{
+  while ( g . held . loadAcquire ( ) == 0 ) QThread::msleep ( 10 ) ;
+}
+
+void tst_Memory::failPolicy(void)
+{
+  QByteArray text = Sample ( 300000 , 1 )                         ;
+  QByteArray bzip2                                                ;
+  QByteArray body                                                 ;
+  QCOMPARE ( Compress ( text , bzip2 , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  Holder     hold                                                 ;
+  qint64     failures = Stat ( "Failures" )                       ;
+  qint64     used     = Stat ( "Used"     )                       ;
+  QVERIFY  ( used > 0                                           ) ;
+  QCOMPARE ( Compress ( text , body , 9 , Policy ( BZ_MEMORY_FAIL ) ) , BZ_MEM_ERROR ) ;
+  QCOMPARE ( Decode ( bzip2 , body , Policy ( BZ_MEMORY_FAIL ) ) , BZ_MEM_ERROR ) ;
+  QCOMPARE ( Stat ( "Failures" ) , failures + 2                 ) ;
+  QCOMPARE ( Stat ( "Used"     ) , used                         ) ;
+}
+
+void tst_Memory::degradePolicy(void)
+{
+  QByteArray text = Sample ( 1200000 , 2 )                        ;
+  QByteArray bzip2                                                ;
+  QByteArray body                                                 ;
+  QCOMPARE ( Compress ( text , bzip2 , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  Holder     hold                                                 ;
+  qint64     degraded = Stat ( "Degraded" )                       ;
+  QByteArray smaller                                              ;
+  // smaller blocks , still a valid archive
+  QCOMPARE ( Compress ( text , smaller , 9 , Policy ( BZ_MEMORY_DEGRADE ) ) , BZ_OK ) ;
+  QVERIFY  ( smaller [ 3 ] < '9'                                ) ;
+  QVERIFY  ( FromBZip2 ( smaller , body )                       ) ;
+  QCOMPARE ( body , text                                        ) ;
+  // the small decoder fits where the fast one does not
+  QCOMPARE ( Decode ( bzip2 , body , Policy ( BZ_MEMORY_DEGRADE ) ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , text                                        ) ;
+  QCOMPARE ( Stat ( "Degraded" ) , degraded + 2                 ) ;
+}
+
+void tst_Memory::waitPolicy(void)
+{
+  QByteArray reference                                            ;
+  QByteArray body                                                 ;
+  Waiter     waiter                                               ;
+  waiter . source = Sample ( 300000 , 3 )                         ;
+  QCOMPARE ( Compress ( waiter . source , reference , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  Holder     hold                                                 ;
+  qint64     waits = Stat ( "Waits" )                             ;
+  waiter . start ( )                                              ;
+  QThread::msleep ( 300 )                                         ;
+  QCOMPARE ( waiter . done . loadAcquire ( ) , 0                ) ;
+  hold . Release ( )                                              ;
+  QVERIFY  ( waiter . wait ( 30000 )                            ) ;
+  QCOMPARE ( waiter . done . loadAcquire ( ) , 1                ) ;
+  QCOMPARE ( waiter . rc , BZ_OK                                ) ;
+  QCOMPARE ( waiter . bzip2 , reference                         ) ;
+  QCOMPARE ( Stat ( "Waits" ) , waits + 1                       ) ;
+  QCOMPARE ( Stat ( "Used"  ) , (qint64) 0                      ) ;
+}
+
+// a multistream decode hands its reservation back between streams
+void tst_Memory::streamBoundary(void)
+{
+  QByteArray   a = Sample ( 800000 , 4 )                          ;
+  QByteArray   b = Sample (  20000 , 5 )                          ;
+  QByteArray   za                                                 ;
+  QByteArray   zb                                                 ;
+  QByteArray   body                                               ;
+  QtBZip2      L                                                  ;
+  QCOMPARE ( Compress ( a , za , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  QVERIFY  ( ToBZip2 ( b , zb , 1 )                             ) ;
+  BZip2SetMemoryBudget ( 64 << 20 )                               ;
+  QCOMPARE ( L . BeginDecompress ( ) , BZ_OK                    ) ;
+  QCOMPARE ( L . doDecompress ( za , body ) , BZ_STREAM_END     ) ;
+  qint64 large = Stat ( "Used" )                                  ;
+  QVERIFY  ( large > 0                                          ) ;
+  // a stream of the same block size reuses the arrays as they are
+  QByteArray head = za . left ( 4 )                               ;
+  QByteArray rest = za . mid  ( 4 )                               ;
+  QCOMPARE ( L . doDecompress ( head , body ) , BZ_OK           ) ;
+  QCOMPARE ( Stat ( "Used" ) , large                            ) ;
+  QCOMPARE ( L . doDecompress ( rest , body ) , BZ_STREAM_END   ) ;
+  QCOMPARE ( Stat ( "Used" ) , large                            ) ;
+  // the level 1 stream reserves for its own block size only
+  QCOMPARE ( L . doDecompress ( zb , body ) , BZ_STREAM_END     ) ;
+  QVERIFY  ( Stat ( "Used" ) > 0                                ) ;
+  QVERIFY  ( Stat ( "Used" ) < large                            ) ;
+  QCOMPARE ( body , a + a + b                                   ) ;
+  L . DecompressDone ( )                                          ;
+  QCOMPARE ( Stat ( "Used" ) , (qint64) 0                       ) ;
+  BZip2SetMemoryBudget ( 0 )                                      ;
+}
+
+// a stream waiting to grow keeps what it already holds counted
+void tst_Memory::heldCounted(void)
+{
+  QByteArray a = Sample ( 800000 , 6 )                            ;
+  QByteArray b = Sample (  20000 , 7 )                            ;
+  Grower     grower                                               ;
+  QCOMPARE ( Compress ( a , grower . large , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  QCOMPARE ( Compress ( b , grower . small , 1 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  Holder     hold                                                 ;
+  qint64     waits = Stat ( "Waits" )                             ;
+  qint64     used                                                 ;
+  grower . start ( )                                              ;
+  Ready    ( grower                                             ) ;
+  used = Stat ( "Used" )                                          ;
+  grower . go . storeRelease ( 1 )                                ;
+  while ( Stat ( "Waits" ) == waits ) QThread::msleep ( 10 )      ;
+  QThread::msleep ( 100 )                                         ;
+  QCOMPARE ( Stat ( "Used" ) , used                             ) ;
+  hold . Release ( )                                              ;
+  QVERIFY  ( grower . wait ( 30000 )                            ) ;
+  QCOMPARE ( grower . rc , BZ_STREAM_END                        ) ;
+  QCOMPARE ( grower . body , b + a                              ) ;
+  QCOMPARE ( Stat ( "Used" ) , (qint64) 0                       ) ;
+}
+
+// two streams each holding a small reservation and each waiting to grow
+// past the budget : nothing else can free room , so one goes ahead
+void tst_Memory::parkedWaiters(void)
+{
+  QByteArray a = Sample ( 800000 , 8 )                            ;
+  QByteArray b = Sample (  20000 , 9 )                            ;
+  QByteArray za                                                   ;
+  QByteArray zb                                                   ;
+  Grower     growers [ 2 ]                                        ;
+  QCOMPARE ( Compress ( a , za , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  QCOMPARE ( Compress ( b , zb , 1 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  BZip2SetMemoryBudget ( 1 << 20 )                                ;
+  for (int i = 0 ; i < 2 ; i++ )                                  {
+    growers [ i ] . small = zb                                    ;
+    growers [ i ] . large = za                                    ;
+    growers [ i ] . start ( )                                     ;
+    Ready ( growers [ i ] )                                       ;
+  }                                                               ;
+  for (int i = 0 ; i < 2 ; i++ ) growers [ i ] . go . storeRelease ( 1 ) ;
+  for (int i = 0 ; i < 2 ; i++ )                                  {
+    QVERIFY  ( growers [ i ] . wait ( 30000 )                   ) ;
+    QCOMPARE ( growers [ i ] . rc , BZ_STREAM_END               ) ;
+    QCOMPARE ( growers [ i ] . body , b + a                     ) ;
+  }                                                               ;
+  QCOMPARE ( Stat ( "Used" ) , (qint64) 0                       ) ;
+  BZip2SetMemoryBudget ( 0 )                                      ;
+}
+
+// even the smallest block finds no room , degrading gives up in time
+void tst_Memory::degradeTimeout(void)
+{
+  QByteArray    text = Sample ( 300000 , 10 )                     ;
+  QByteArray    bzip2                                             ;
+  QByteArray    body                                              ;
+  QElapsedTimer clock                                             ;
+  QCOMPARE ( Compress ( text , bzip2 , 9 , Policy ( BZ_MEMORY_DEFAULT ) ) , BZ_OK ) ;
+  Holder        hold                                              ;
+  qint64        used     = Stat ( "Used"     )                    ;
+  qint64        failures = Stat ( "Failures" )                    ;
+  BZip2SetMemoryBudget ( used + 1000 )                            ;
+  clock . start ( )                                               ;
+  QCOMPARE ( Compress ( text , body , 9 , Policy ( BZ_MEMORY_DEGRADE ) ) , BZ_MEM_ERROR ) ;
+  QCOMPARE ( Decode ( bzip2 , body , Policy ( BZ_MEMORY_DEGRADE ) ) , BZ_MEM_ERROR ) ;
+  QVERIFY  ( clock . elapsed ( ) < 30000                        ) ;
+  QCOMPARE ( Stat ( "Failures" ) , failures + 2                 ) ;
+  QCOMPARE ( Stat ( "Used"     ) , used                         ) ;
+}
+
+void tst_Memory::badPolicy(void)
+{
+  QtBZip2      L                                                  ;
+  QVariantList v                                                  ;
+  QVariantMap  o                                                  ;
+  o [ "Memory" ] = BZ_MEMORY_DEGRADE + 1                          ;
+  v << 9 << 30 << o                                               ;
+  QCOMPARE ( L . BeginCompress ( v ) , BZ_PARAM_ERROR           ) ;
+  QCOMPARE ( Stat ( "Used" ) , (qint64) 0                       ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Memory)
+#include "tst_memory.moc"
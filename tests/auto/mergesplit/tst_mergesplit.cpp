@@ -0,0 +1,121 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_MergeSplit : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void mergeRoundTrip   ( void ) ;
+    void splitRoundTrip   ( void ) ;
+    void multistreamInput ( void ) ;
+    void trailingGarbage  ( void ) ;
+    void malformedInput   ( void ) ;
+} ;
+
+void tst_MergeSplit::mergeRoundTrip(void)
+{
+  QByteArray        a = Sample (  50000 , 1 )                 ;
+  QByteArray        b = Sample ( 250000 , 2 )                 ;
+  QByteArray        c = Sample (   1000 , 3 )                 ;
+  QList<QByteArray> archives                                  ;
+  QByteArray        merged                                    ;
+  int               rc                                        ;
+  archives << Compress ( a , 9 )                              ;
+  archives << Compress ( b , 1 )                              ;
+  archives << Compress ( c , 5 )                              ;
+  QVERIFY  ( MergeBZip2 ( archives , merged )               ) ;
+  QCOMPARE ( Decode ( merged , &rc ) , a + b + c            ) ;
+  QCOMPARE ( rc , BZ_STREAM_END                             ) ;
+  // one stream : nothing follows the first end-of-stream marker
+  QByteArray one = merged                                     ;
+  QList<QByteArray> pieces                                    ;
+  QVERIFY  ( SplitBZip2 ( one , pieces , 1000 )             ) ;
+  QCOMPARE ( pieces . count ( ) , 1                         ) ;
+  QCOMPARE ( pieces [ 0 ] , merged                          ) ;
+}
+
+void tst_MergeSplit::splitRoundTrip(void)
+{
+  QByteArray        source = Sample ( 450000 , 7 )            ;
+  QByteArray        bzip2  = Compress ( source , 1 )          ;
+  QList<QByteArray> pieces                                    ;
+  QByteArray        joined                                    ;
+  QByteArray        merged                                    ;
+  int               rc                                        ;
+  QVERIFY  ( SplitBZip2 ( bzip2 , pieces , 1 )              ) ;
+  QVERIFY  ( pieces . count ( ) >= 4                        ) ;
+  for (int i = 0 ; i < pieces . count ( ) ; i++ )             {
+    joined . append ( Decode ( pieces [ i ] , &rc ) )         ;
+    QCOMPARE ( rc , BZ_STREAM_END                           ) ;
+  }                                                           ;
+  QCOMPARE ( joined , source                                ) ;
+  QVERIFY  ( MergeBZip2 ( pieces , merged )                 ) ;
+  QCOMPARE ( merged , bzip2                                 ) ;
+}
+
+void tst_MergeSplit::multistreamInput(void)
+{
+  QByteArray        a = Sample ( 30000 , 11 )                 ;
+  QByteArray        b = Sample ( 40000 , 12 )                 ;
+  QByteArray        two = Compress ( a , 9 ) + Compress ( b , 9 ) ;
+  QList<QByteArray> archives                                  ;
+  QList<QByteArray> pieces                                    ;
+  QByteArray        merged                                    ;
+  int               rc                                        ;
+  archives << two                                             ;
+  QVERIFY  ( MergeBZip2 ( archives , merged )               ) ;
+  QCOMPARE ( Decode ( merged , &rc ) , a + b                ) ;
+  QCOMPARE ( rc , BZ_STREAM_END                             ) ;
+  QVERIFY  ( SplitBZip2 ( two , pieces , 1 )                ) ;
+  QCOMPARE ( pieces . count ( ) , 2                         ) ;
+  QCOMPARE ( Decode ( pieces [ 1 ] , &rc ) , b              ) ;
+}
+
+// bytes after the last stream , even ones that look like a block , are
+// left out of the merged stream
+void tst_MergeSplit::trailingGarbage(void)
+{
+  QByteArray        source = Sample ( 60000 , 21 )            ;
+  QByteArray        clean  = Compress ( source , 9 )          ;
+  QByteArray        dirty  = clean                            ;
+  QList<QByteArray> archives                                  ;
+  QByteArray        merged                                    ;
+  dirty . append ( QByteArray ( "\x31\x41\x59\x26\x53\x59junk" , 10 ) ) ;
+  dirty . append ( QByteArray ( 100 , 'x' )                 ) ;
+  archives << dirty                                           ;
+  QVERIFY  ( MergeBZip2 ( archives , merged )               ) ;
+  QCOMPARE ( merged , clean                                 ) ;
+}
+
+void tst_MergeSplit::malformedInput(void)
+{
+  QByteArray        source = Sample ( 250000 , 31 )           ;
+  QByteArray        bzip2  = Compress ( source , 1 )          ;
+  QList<QByteArray> archives                                  ;
+  QList<QByteArray> pieces                                    ;
+  QByteArray        merged                                    ;
+  // truncated : the last block never reaches an end-of-stream marker
+  archives . clear ( )                                        ;
+  archives << bzip2 . left ( bzip2 . size ( ) - 20 )          ;
+  QVERIFY  ( ! MergeBZip2 ( archives , merged )             ) ;
+  QVERIFY  ( ! SplitBZip2 ( archives [ 0 ] , pieces , 1 )   ) ;
+  // no BZh header in front of the block markers
+  archives . clear ( )                                        ;
+  archives << bzip2 . mid ( 4 )                               ;
+  QVERIFY  ( ! MergeBZip2 ( archives , merged )             ) ;
+  // combined CRC does not match the blocks
+  QByteArray broken = bzip2                                   ;
+  broken [ broken . size ( ) - 2 ] = (char)( broken [ broken . size ( ) - 2 ] ^ 0x10 ) ;
+  archives . clear ( )                                        ;
+  archives << broken                                          ;
+  QVERIFY  ( ! MergeBZip2 ( archives , merged )             ) ;
+  // one bad archive fails the whole merge
+  archives . clear ( )                                        ;
+  archives << bzip2 << QByteArray ( "not a bzip2 archive" )   ;
+  QVERIFY  ( ! MergeBZip2 ( archives , merged )             ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_MergeSplit)
+#include "tst_mergesplit.moc"
@@ -0,0 +1,142 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_MultiStream : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void wholeBuffer     ( void ) ;
+    void chunkedInput    ( void ) ;
+    void sectionInput    ( void ) ;
+    void emptyStream     ( void ) ;
+    void uncompressCall  ( void ) ;
+} ;
+
+// three streams , the later ones declaring larger blocks than the first
+static QByteArray Archive(QByteArray & plain,QList<int> & sizes)
+{
+  QByteArray a = Sample (  40000 , 1 )    ;
+  QByteArray b = Sample ( 350000 , 2 )    ;
+  QByteArray c = Sample (  90000 , 3 )    ;
+  QByteArray za = Compress ( a , 1 )      ;
+  QByteArray zb = Compress ( b , 9 )      ;
+  QByteArray zc = Compress ( c , 5 )      ;
+  plain = a + b + c                       ;
+  sizes . clear ( )                       ;
+  sizes << za . size ( )                  ;
+  sizes << zb . size ( )                  ;
+  sizes << zc . size ( )                  ;
+  return za + zb + zc                     ;
+}
+
+void tst_MultiStream::wholeBuffer(void)
+{
+  QtBZip2      L                                                  ;
+  QByteArray   plain                                              ;
+  QList<int>   sizes                                              ;
+  QByteArray   bzip2 = Archive ( plain , sizes )                  ;
+  QByteArray   body                                               ;
+  QCOMPARE ( L . BeginDecompress ( ) , BZ_OK                    ) ;
+  QCOMPARE ( L . doDecompress ( bzip2 , body ) , BZ_STREAM_END  ) ;
+  QCOMPARE ( body , plain                                       ) ;
+  QVariantList streams = L . Streams ( )                          ;
+  QCOMPARE ( streams . count ( ) , 3                            ) ;
+  qint64 in  = 0                                                  ;
+  qint64 out = 0                                                  ;
+  int    lv [ 3 ] = { 1 , 9 , 5 }                                 ;
+  int    ln [ 3 ] = { 40000 , 350000 , 90000 }                    ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QVariantMap V = streams [ i ] . toMap ( )                     ;
+    QCOMPARE ( V [ "Stream"     ] . toInt       ( ) , i         ) ;
+    QCOMPARE ( V [ "Input"      ] . toLongLong  ( ) , in        ) ;
+    QCOMPARE ( V [ "Compressed" ] . toLongLong  ( ) , (qint64) sizes [ i ] ) ;
+    QCOMPARE ( V [ "Output"     ] . toLongLong  ( ) , out       ) ;
+    QCOMPARE ( V [ "Size"       ] . toLongLong  ( ) , (qint64) ln [ i ] ) ;
+    QCOMPARE ( V [ "Level"      ] . toInt       ( ) , lv [ i ]  ) ;
+    in  += sizes [ i ]                                            ;
+    out += ln    [ i ]                                            ;
+  }                                                               ;
+  QCOMPARE ( streams [ 1 ] . toMap ( ) [ "Blocks" ] . toInt ( ) , 1 ) ;
+  L . DecompressDone ( )                                          ;
+}
+
+// stream boundaries falling anywhere inside the pieces
+void tst_MultiStream::chunkedInput(void)
+{
+  QByteArray   plain                                              ;
+  QList<int>   sizes                                              ;
+  QByteArray   bzip2 = Archive ( plain , sizes )                  ;
+  int          piece [ 3 ] = { 1 , 777 , 65536 }                  ;
+  for (int p = 0 ; p < 3 ; p++ )                                  {
+    QtBZip2    L                                                  ;
+    QByteArray body                                               ;
+    int        rc    = BZ_OK                                      ;
+    QCOMPARE ( L . BeginDecompress ( ) , BZ_OK                  ) ;
+    for (int at = 0 ; at < bzip2 . size ( ) ; at += piece [ p ] ) {
+      rc = L . doDecompress ( bzip2 . mid ( at , piece [ p ] ) , body ) ;
+      QVERIFY ( L . IsCorrect ( rc )                            ) ;
+    }                                                             ;
+    QCOMPARE ( rc , BZ_STREAM_END                               ) ;
+    QCOMPARE ( body , plain                                     ) ;
+    QCOMPARE ( L . Streams ( ) . count ( ) , 3                  ) ;
+    L . DecompressDone ( )                                        ;
+  }                                                               ;
+}
+
+void tst_MultiStream::sectionInput(void)
+{
+  QtBZip2      L                                                  ;
+  QByteArray   plain                                              ;
+  QList<int>   sizes                                              ;
+  QByteArray   source = Archive ( plain , sizes )                 ;
+  QByteArray   body                                               ;
+  int          rc     = BZ_OK                                     ;
+  int          turns  = 0                                         ;
+  QCOMPARE ( L . BeginDecompress ( ) , BZ_OK                    ) ;
+  while ( ( rc == BZ_OK ) && ( turns++ < 100000 ) )               {
+    QByteArray part                                               ;
+    rc = L . undoSection ( source , part )                        ;
+    body . append ( part )                                        ;
+  }                                                               ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QCOMPARE ( source . size ( ) , 0                              ) ;
+  QCOMPARE ( body , plain                                       ) ;
+  QCOMPARE ( L . Streams ( ) . count ( ) , 3                    ) ;
+  L . DecompressDone ( )                                          ;
+}
+
+// a stream with no blocks between two others
+void tst_MultiStream::emptyStream(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray a     = Sample ( 5000 , 4 )                          ;
+  QByteArray b     = Sample ( 7000 , 5 )                          ;
+  QByteArray empty = Compress ( QByteArray ( ) , 9 )              ;
+  QByteArray body                                                 ;
+  QCOMPARE ( empty . size ( ) , 14                              ) ;
+  QCOMPARE ( L . BeginDecompress ( ) , BZ_OK                    ) ;
+  QCOMPARE ( L . doDecompress ( Compress ( a , 9 ) + empty + Compress ( b , 9 ) , body ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , a + b                                       ) ;
+  QCOMPARE ( L . Streams ( ) . count ( ) , 3                    ) ;
+  QCOMPARE ( L . Streams ( ) [ 1 ] . toMap ( ) [ "Size" ] . toInt ( ) , 0 ) ;
+  L . DecompressDone ( )                                          ;
+}
+
+void tst_MultiStream::uncompressCall(void)
+{
+  QByteArray plain                                                ;
+  QList<int> sizes                                                ;
+  QByteArray bzip2 = Archive ( plain , sizes )                    ;
+  QByteArray data                                                 ;
+  int        rc                                                   ;
+  QCOMPARE ( BZip2Uncompress ( bzip2 ) , plain                  ) ;
+  QCOMPARE ( BZip2Uncompress ( bzip2 , QVariantMap ( ) , &rc ) , plain ) ;
+  QCOMPARE ( rc , BZ_STREAM_END                                 ) ;
+  QVERIFY  ( FromBZip2 ( bzip2 , data )                         ) ;
+  QCOMPARE ( data , plain                                       ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_MultiStream)
+#include "tst_multistream.moc"
@@ -0,0 +1,163 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Pipeline : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void compressIdentical ( void ) ;
+    void compressPieces    ( void ) ;
+    void compressFlush     ( void ) ;
+    void decodeIdentical   ( void ) ;
+    void decodeMultistream ( void ) ;
+    void decodeCorrupt     ( void ) ;
+    void decodeBacklog     ( void ) ;
+    void parkedDecoder     ( void ) ;
+} ;
+
+static QVariantMap Pipe(bool pipeline)
+{
+  QVariantMap o                           ;
+  o [ "Pipeline" ] = pipeline             ;
+  return o                                ;
+}
+
+void tst_Pipeline::compressIdentical(void)
+{
+  QByteArray text = Sample ( 1200000 , 1 )                        ;
+  QByteArray body                                                 ;
+  int        lv [ 3 ] = { 1 , 5 , 9 }                             ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QByteArray z = Compress ( text , lv [ i ] , Pipe ( true ) )   ;
+    QCOMPARE ( z , Compress ( text , lv [ i ] , Pipe ( false ) ) ) ;
+    QCOMPARE ( Decode ( z , body , Pipe ( false ) , 4096 ) , BZ_STREAM_END ) ;
+    QCOMPARE ( body , text                                      ) ;
+  }                                                               ;
+}
+
+void tst_Pipeline::compressPieces(void)
+{
+  QByteArray text   = Sample ( 700000 , 2 )                       ;
+  QByteArray serial = Compress ( text , 1 , Pipe ( false ) )      ;
+  QCOMPARE ( Compress ( text , 1 , Pipe ( true ) ,   1000 ) , serial ) ;
+  QCOMPARE ( Compress ( text , 1 , Pipe ( true ) ,  99999 ) , serial ) ;
+  QCOMPARE ( Compress ( text , 1 , Pipe ( true ) , 250000 ) , serial ) ;
+  QCOMPARE ( Compress ( QByteArray ( ) , 9 , Pipe ( true  ) ) ,
+             Compress ( QByteArray ( ) , 9 , Pipe ( false ) )   ) ;
+}
+
+// a sync flush waits for the blocks in flight
+void tst_Pipeline::compressFlush(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray first  = Sample ( 450000 , 3 )                       ;
+  QByteArray second = Sample (  20000 , 4 )                       ;
+  QByteArray wire                                                 ;
+  QByteArray part                                                 ;
+  QByteArray body                                                 ;
+  QVariantList v                                                  ;
+  v << 1 << 30 << Pipe ( true )                                   ;
+  QCOMPARE ( L . BeginCompress ( v ) , BZ_OK                    ) ;
+  QCOMPARE ( L . doCompress ( first , part ) , BZ_OK            ) ;
+  wire . append ( part )                                          ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . Flush ( part , true ) , BZ_OK                  ) ;
+  wire . append ( part )                                          ;
+  QCOMPARE ( Decode ( wire , body , Pipe ( false ) , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , first                                       ) ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . doCompress ( second , part ) , BZ_OK           ) ;
+  wire . append ( part )                                          ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . CompressDone ( part ) , BZ_OK                  ) ;
+  wire . append ( part )                                          ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( Decode ( wire , body , Pipe ( true ) , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , first + second                              ) ;
+}
+
+void tst_Pipeline::decodeIdentical(void)
+{
+  QByteArray text  = Sample ( 1200000 , 5 )                       ;
+  QByteArray bzip2 = Compress ( text , 1 , Pipe ( false ) )       ;
+  QByteArray body                                                 ;
+  int        piece [ 3 ] = { 1000 , 65536 , 1 << 24 }             ;
+  for (int i = 0 ; i < 3 ; i++ )                                  {
+    QCOMPARE ( Decode ( bzip2 , body , Pipe ( true ) , piece [ i ] ) , BZ_STREAM_END ) ;
+    QCOMPARE ( body , text                                      ) ;
+  }                                                               ;
+}
+
+void tst_Pipeline::decodeMultistream(void)
+{
+  QByteArray a     = Sample ( 300000 , 6 )                        ;
+  QByteArray b     = Sample ( 900000 , 7 )                        ;
+  QByteArray bzip2 = Compress ( a , 9 , Pipe ( true ) )
+                   + Compress ( b , 2 , Pipe ( true ) )           ;
+  QByteArray body                                                 ;
+  QCOMPARE ( Decode ( bzip2 , body , Pipe ( true ) , 4096 ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , a + b                                       ) ;
+}
+
+// a damaged block fails the same way with and without the pipeline
+void tst_Pipeline::decodeCorrupt(void)
+{
+  QByteArray text  = Sample ( 600000 , 8 )                        ;
+  QByteArray bzip2 = Compress ( text , 1 , Pipe ( false ) )       ;
+  QByteArray body                                                 ;
+  bzip2 [ bzip2 . size ( ) / 2 ] = bzip2 [ bzip2 . size ( ) / 2 ] ^ 0x10 ;
+  int serial = Decode ( bzip2 , body , Pipe ( false ) , 4096 )    ;
+  QVERIFY  ( serial < 0                                         ) ;
+  QCOMPARE ( Decode ( bzip2 , body , Pipe ( true ) , 4096 ) , serial ) ;
+}
+
+// one block of zeros expands far past the queue the worker may fill ,
+// it parks and resumes until the block is out
+void tst_Pipeline::decodeBacklog(void)
+{
+  QByteArray zeros ( 40 << 20 , 0 )                               ;
+  QByteArray text  = Sample ( 300000 , 9 )                        ;
+  QByteArray bzip2 = Compress ( zeros + text + zeros , 9 , Pipe ( false ) ) ;
+  QByteArray body                                                 ;
+  int        piece [ 2 ] = { 16 , 1 << 24 }                       ;
+  for (int i = 0 ; i < 2 ; i++ )                                  {
+    QCOMPARE ( Decode ( bzip2 , body , Pipe ( true ) , piece [ i ] ) , BZ_STREAM_END ) ;
+    QVERIFY  ( body == zeros + text + zeros                     ) ;
+  }                                                               ;
+}
+
+// a parked worker gives its thread back : a pipelined compressor on the
+// only pool thread still finishes , and a decoder dropped while its worker
+// is parked ends at once
+void tst_Pipeline::parkedDecoder(void)
+{
+  QByteArray zeros ( 40 << 20 , 0 )                               ;
+  QByteArray text  = Sample ( 300000 , 10 )                       ;
+  QByteArray bzip2 = Compress ( zeros , 9 , Pipe ( false ) )      ;
+  QByteArray head  = bzip2 . left ( bzip2 . size ( ) - 4 )        ;
+  QByteArray tail  = bzip2 . right ( 4 )                          ;
+  QByteArray body                                                 ;
+  QByteArray part                                                 ;
+  BZip2SetThreads ( 1 )                                           ;
+  for (int i = 0 ; i < 2 ; i++ )                                  {
+    QtBZip2      L                                                ;
+    QVariantList v                                                ;
+    v << Pipe ( true )                                            ;
+    QCOMPARE ( L . BeginDecompress ( v ) , BZ_OK                ) ;
+    QCOMPARE ( L . doDecompress ( head , body ) , BZ_OK         ) ;
+    QVERIFY  ( body . size ( ) < zeros . size ( )               ) ;
+    if ( i == 0 )                                                 {
+      QByteArray z = Compress ( text , 9 , Pipe ( true ) )        ;
+      QCOMPARE ( Decode ( z ) , text                            ) ;
+      QCOMPARE ( L . doDecompress ( tail , part ) , BZ_STREAM_END ) ;
+      QVERIFY  ( body + part == zeros                           ) ;
+    }                                                             ;
+    L . DecompressDone ( )                                        ;
+  }                                                               ;
+  BZip2SetThreads ( 0 )                                           ;
+}
+
+QTEST_GUILESS_MAIN(tst_Pipeline)
+#include "tst_pipeline.moc"
@@ -0,0 +1,70 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Recover : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void intactStream ( void ) ;
+    void middleBlock  ( void ) ;
+} ;
+
+void tst_Recover::intactStream(void)
+{
+  QByteArray   text  = Sample ( 450000 , 1 )                      ;
+  QByteArray   bzip2 = Compress ( text , 1 )                      ;
+  QByteArray   data                                               ;
+  QVariantList report                                             ;
+  QVERIFY  ( RecoverBZip2 ( bzip2 , data , report , 2 )         ) ;
+  QCOMPARE ( data , text                                        ) ;
+  QVERIFY  ( report . count ( ) >= 4                            ) ;
+  for (int i = 0 ; i < report . count ( ) ; i++ )                 {
+    QCOMPARE ( report [ i ] . toMap ( ) [ "Status" ] . toInt ( ) , BZ_OK ) ;
+  }                                                               ;
+}
+
+// the blocks around a damaged one come back , the report places it
+void tst_Recover::middleBlock(void)
+{
+  QByteArray   text  = Sample ( 450000 , 2 )                      ;
+  QByteArray   bzip2 = Compress ( text , 1 )                      ;
+  QByteArray   clean                                              ;
+  QByteArray   data                                               ;
+  QVariantList intact                                             ;
+  QVariantList report                                             ;
+  QVERIFY  ( RecoverBZip2 ( bzip2 , clean , intact , 2 )        ) ;
+  QVERIFY  ( intact . count ( ) >= 4                            ) ;
+  QVariantMap  bad   = intact [ 2 ] . toMap ( )                   ;
+  qint64       bit   = bad [ "Bit"  ] . toLongLong ( )            ;
+  qint64       bits  = bad [ "Bits" ] . toLongLong ( )            ;
+  qint64       at    = bad [ "Offset" ] . toLongLong ( )          ;
+  qint64       size  = bad [ "Size"   ] . toLongLong ( )          ;
+  int          hit   = (int) ( ( bit + bits / 2 ) / 8 )           ;
+  bzip2 [ hit ] = (char) ( bzip2 [ hit ] ^ 0x55 )                 ;
+  QVERIFY  ( RecoverBZip2 ( bzip2 , data , report , 2 )         ) ;
+  QCOMPARE ( report . count ( ) , intact . count ( )            ) ;
+  QCOMPARE ( data , text . left ( (int) at ) + text . mid ( (int) ( at + size ) ) ) ;
+  for (int i = 0 ; i < report . count ( ) ; i++ )                 {
+    QVariantMap R = report [ i ] . toMap ( )                      ;
+    QCOMPARE ( R [ "Block" ] . toInt ( ) , i                    ) ;
+    QCOMPARE ( R [ "Bit"   ] . toLongLong ( ) , intact [ i ] . toMap ( ) [ "Bit"  ] . toLongLong ( ) ) ;
+    QCOMPARE ( R [ "Bits"  ] . toLongLong ( ) , intact [ i ] . toMap ( ) [ "Bits" ] . toLongLong ( ) ) ;
+    if ( i != 2 )                                                 {
+      QCOMPARE ( R [ "Status" ] . toInt ( ) , BZ_OK             ) ;
+      continue                                                    ;
+    }                                                             ;
+    QVERIFY  ( R [ "Status" ] . toInt ( ) != BZ_OK              ) ;
+    QCOMPARE ( R [ "Offset" ] . toLongLong ( ) , at             ) ;
+    QCOMPARE ( R [ "Size"   ] . toInt ( ) , 0                   ) ;
+    QVERIFY  ( hit * 8 >= bit                                   ) ;
+    QVERIFY  ( hit * 8 <  bit + bits                            ) ;
+    // the estimate of the lost bytes is in the block's range
+    QVERIFY  ( R [ "Lost" ] . toLongLong ( ) > size / 2         ) ;
+    QVERIFY  ( R [ "Lost" ] . toLongLong ( ) < size * 2         ) ;
+  }                                                               ;
+}
+
+QTEST_GUILESS_MAIN(tst_Recover)
+#include "tst_recover.moc"
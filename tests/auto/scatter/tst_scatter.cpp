@@ -0,0 +1,170 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Scatter : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void listInput        ( void ) ;
+    void spanInput        ( void ) ;
+    void inputChecksum    ( void ) ;
+    void outputSegments   ( void ) ;
+    void segmentsFull     ( void ) ;
+} ;
+
+// fragment sizes , zeros included , adding up to the whole source
+static QList<QByteArray> Fragments(const QByteArray & source)
+{
+  int               sizes [ 7 ] = { 0 , 1 , 4095 , 0 , 65537 , 250000 , 0 } ;
+  QList<QByteArray> list                                          ;
+  int               at = 0                                        ;
+  for (int i = 0 ; i < 7 ; i++ )                                  {
+    list << source . mid ( at , sizes [ i ] )                     ;
+    at += sizes [ i ]                                             ;
+  }                                                               ;
+  list << source . mid ( at )                                     ;
+  return list                                                     ;
+}
+
+static unsigned int Checksum(const QByteArray & data)
+{
+  unsigned int crc = 0xffffffffU                                  ;
+  BZip2CRC ( data , crc )                                         ;
+  return ~crc                                                     ;
+}
+
+void tst_Scatter::listInput(void)
+{
+  QByteArray        source = Sample ( 700000 , 1 )                ;
+  QList<QByteArray> list   = Fragments ( source )                 ;
+  QtBZip2           L                                             ;
+  QByteArray        bzip2                                         ;
+  QByteArray        tail                                          ;
+  QVariantList      v                                             ;
+  v << 9 << 30 << QVariantMap ( )                                 ;
+  QCOMPARE ( L . BeginCompress ( v ) , BZ_OK                    ) ;
+  QCOMPARE ( L . doCompress ( list , bzip2 ) , BZ_OK            ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( bzip2 + tail , Compress ( source , 9 )             ) ;
+  bzip2 . clear ( )                                               ;
+  QVERIFY  ( ToBZip2 ( list , bzip2 , 5 )                       ) ;
+  QCOMPARE ( Decode ( bzip2 ) , source                          ) ;
+}
+
+void tst_Scatter::spanInput(void)
+{
+  QByteArray        source = Sample ( 700000 , 2 )                ;
+  QList<QByteArray> list   = Fragments ( source )                 ;
+  QVector<BZip2Span> spans ( list . count ( ) + 1 )               ;
+  QtBZip2           L                                             ;
+  QByteArray        bzip2                                         ;
+  QByteArray        tail                                          ;
+  for (int i = 0 ; i < list . count ( ) ; i++ )                   {
+    spans [ i ] . data = list [ i ] . data ( )                    ;
+    spans [ i ] . size = list [ i ] . size ( )                    ;
+  }                                                               ;
+  // an empty span may carry no pointer at all
+  spans [ list . count ( ) ] . data = NULL                        ;
+  spans [ list . count ( ) ] . size = 0                           ;
+  QCOMPARE ( L . BeginCompress ( 1 , 30 ) , BZ_OK               ) ;
+  QCOMPARE ( L . doCompress ( spans . constData ( ) , spans . count ( ) , bzip2 ) , BZ_OK ) ;
+  QCOMPARE ( L . CompressDone ( tail ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  QCOMPARE ( bzip2 + tail , Compress ( source , 1 )             ) ;
+  QCOMPARE ( L . BeginCompress ( 1 , 30 ) , BZ_OK               ) ;
+  QCOMPARE ( L . doCompress ( spans . constData ( ) , 0 , bzip2 ) , BZ_OK ) ;
+  QVERIFY  ( bzip2 . isEmpty ( )                                ) ;
+  L . CompressDone ( tail )                                       ;
+  L . CleanUp ( )                                                 ;
+}
+
+// runs cross block ends , the CRC still covers every byte exactly once
+void tst_Scatter::inputChecksum(void)
+{
+  QByteArray        source = QByteArray ( 120000 , 'a' )
+                           + Sample ( 500000 , 3 )
+                           + QByteArray ( 99990 , 'b' )
+                           + Noise  ( 300000 , 4 )                ;
+  QList<QByteArray> list   = Fragments ( source )                 ;
+  QVariantMap       pipe                                          ;
+  pipe [ "Pipeline" ] = true                                      ;
+  for (int p = 0 ; p < 2 ; p++ )                                  {
+    QtBZip2      L                                                ;
+    QByteArray   part                                             ;
+    QByteArray   wire                                             ;
+    QVariantList v                                                ;
+    v << 1 << 30 << ( p ? pipe : QVariantMap ( ) )                ;
+    QCOMPARE ( L . BeginCompress ( v ) , BZ_OK                  ) ;
+    QCOMPARE ( L . InputCRC ( ) , Checksum ( QByteArray ( ) )   ) ;
+    QCOMPARE ( L . doCompress ( list , part ) , BZ_OK           ) ;
+    wire . append ( part )                                        ;
+    QCOMPARE ( L . InputCRC ( ) , Checksum ( source )           ) ;
+    // a sync flush starts a new stream , the CRC goes on
+    QCOMPARE ( L . Flush ( part , true ) , BZ_OK                ) ;
+    wire . append ( part )                                        ;
+    QCOMPARE ( L . doCompress ( source , part ) , BZ_OK         ) ;
+    wire . append ( part )                                        ;
+    QCOMPARE ( L . InputCRC ( ) , Checksum ( source + source )  ) ;
+    part . clear ( )                                              ;
+    QCOMPARE ( L . CompressDone ( part ) , BZ_OK                ) ;
+    wire . append ( part )                                        ;
+    QCOMPARE ( L . InputCRC ( ) , Checksum ( source + source )  ) ;
+    L . CleanUp ( )                                               ;
+    QCOMPARE ( Decode ( wire ) , source + source                ) ;
+  }                                                               ;
+}
+
+void tst_Scatter::outputSegments(void)
+{
+  QByteArray source = Sample ( 400000 , 5 )                       ;
+  QByteArray bzip2  = Compress ( source , 9 ) + Compress ( source . left ( 1000 ) , 1 ) ;
+  QByteArray whole  = source + source . left ( 1000 )             ;
+  QByteArray a ( 1000 , 0 )                                       ;
+  QByteArray b ( 65536 , 0 )                                      ;
+  QByteArray c ( whole . size ( ) , 0 )                           ;
+  BZip2Span  segments [ 5 ]                                       ;
+  segments [ 0 ] . data = NULL         ; segments [ 0 ] . size = 0 ;
+  segments [ 1 ] . data = a . data ( ) ; segments [ 1 ] . size = a . size ( ) ;
+  segments [ 2 ] . data = b . data ( ) ; segments [ 2 ] . size = 0 ;
+  segments [ 3 ] . data = b . data ( ) ; segments [ 3 ] . size = b . size ( ) ;
+  segments [ 4 ] . data = c . data ( ) ; segments [ 4 ] . size = c . size ( ) ;
+  qint64 n = BZip2DecompressInto ( segments , 5 , bzip2 . constData ( ) , bzip2 . size ( ) ) ;
+  QCOMPARE ( n , (qint64) whole . size ( )                      ) ;
+  QCOMPARE ( a + b + c . left ( (int) n - a . size ( ) - b . size ( ) ) , whole ) ;
+  // the same bytes as the single buffer call
+  QByteArray one ( whole . size ( ) , 0 )                         ;
+  QCOMPARE ( BZip2DecompressInto ( one . data ( ) , one . size ( ) ,
+                                   bzip2 . constData ( ) , bzip2 . size ( ) ) , n ) ;
+  QCOMPARE ( one , whole                                        ) ;
+}
+
+// a last segment one byte short fails without writing past its end
+void tst_Scatter::segmentsFull(void)
+{
+  QByteArray source = Sample ( 300000 , 6 )                       ;
+  QByteArray bzip2  = Compress ( source , 9 )                     ;
+  QByteArray a ( 100000 , 0 )                                     ;
+  QByteArray b ( source . size ( ) - a . size ( ) , 0 )           ;
+  QByteArray guard ( b . size ( ) + 1 , '#' )                     ;
+  BZip2Span  segments [ 2 ]                                       ;
+  segments [ 0 ] . data = a . data ( )                            ;
+  segments [ 0 ] . size = a . size ( )                            ;
+  segments [ 1 ] . data = guard . data ( )                        ;
+  segments [ 1 ] . size = b . size ( ) - 1                        ;
+  QCOMPARE ( BZip2DecompressInto ( segments , 2 , bzip2 . constData ( ) , bzip2 . size ( ) ) ,
+             (qint64) BZ_OUTBUFF_FULL                           ) ;
+  QCOMPARE ( guard [ b . size ( ) - 1 ] , '#'                   ) ;
+  QCOMPARE ( guard [ b . size ( )     ] , '#'                   ) ;
+  QCOMPARE ( a + guard . left ( b . size ( ) - 1 ) , source . left ( source . size ( ) - 1 ) ) ;
+  segments [ 1 ] . size = b . size ( )                            ;
+  QCOMPARE ( BZip2DecompressInto ( segments , 2 , bzip2 . constData ( ) , bzip2 . size ( ) ) ,
+             (qint64) source . size ( )                         ) ;
+  QCOMPARE ( a + guard . left ( b . size ( ) ) , source         ) ;
+  QCOMPARE ( guard [ b . size ( ) ] , '#'                       ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Scatter)
+#include "tst_scatter.moc"
@@ -0,0 +1,164 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Scheduler : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void singleWorker      ( void ) ;
+    void concurrentStreams ( void ) ;
+    void statistics        ( void ) ;
+    void strideShare       ( void ) ;
+    void badPriority       ( void ) ;
+} ;
+
+// every parallel stage of one stream at once
+static QVariantMap Everything(int priority)
+{
+  QVariantMap o                         ;
+  o [ "Pipeline" ] = true               ;
+  o [ "Threads"  ] = 4                  ;
+  o [ "Priority" ] = priority           ;
+  return o                              ;
+}
+
+class Worker : public QThread
+{
+  public:
+    QByteArray  source                                      ;
+    QByteArray  reference                                   ;
+    QVariantMap options                                     ;
+    bool        ok                                          ;
+  protected:
+    virtual void run (void)
+    {
+      QByteArray bzip2 = Compress ( source , 9 , options , 100000 ) ;
+      QByteArray body                                       ;
+      ok = ( bzip2 == reference )                          &&
+           ( Decode ( bzip2 , body , options ) == BZ_STREAM_END ) &&
+           ( body == source )                               ;
+    }
+}                                                           ;
+
+// compresses only , keeping the scheduler counters of the moment it ended
+class Streamer : public QThread
+{
+  public:
+    QByteArray  source                                      ;
+    QVariantMap options                                     ;
+    QVariantMap stats                                       ;
+  protected:
+    virtual void run (void)
+    {
+      Compress ( source , 1 , options , 100000 )            ;
+      stats = BZip2SchedulerStats ( )                       ;
+    }
+}                                                           ;
+
+static qint64 Dispatched(const QVariantMap & stats,int priority)
+{
+  return stats [ "Dispatched" ] . toList ( ) [ priority - 1 ] . toLongLong ( ) ;
+}
+
+// nested stages run on the waiting thread when no worker is free
+void tst_Scheduler::singleWorker(void)
+{
+  QByteArray text      = Sample ( 1500000 , 1 )                   ;
+  QByteArray reference = Compress ( text , 9 )                    ;
+  QByteArray body                                                 ;
+  BZip2SetThreads ( 1 )                                           ;
+  QByteArray bzip2     = Compress ( text , 9 , Everything ( 4 ) , 100000 ) ;
+  QCOMPARE ( bzip2 , reference                                  ) ;
+  QCOMPARE ( Decode ( bzip2 , body , Everything ( 4 ) ) , BZ_STREAM_END ) ;
+  QCOMPARE ( body , text                                        ) ;
+  BZip2SetThreads ( 0 )                                           ;
+}
+
+void tst_Scheduler::concurrentStreams(void)
+{
+  Worker     workers [ 6 ]                                        ;
+  QByteArray texts   [ 2 ]                                        ;
+  QByteArray refs    [ 2 ]                                        ;
+  texts [ 0 ] = Sample ( 900000 , 2 )                             ;
+  texts [ 1 ] = Sample ( 400000 , 3 )                             ;
+  refs  [ 0 ] = Compress ( texts [ 0 ] , 9 )                      ;
+  refs  [ 1 ] = Compress ( texts [ 1 ] , 9 )                      ;
+  BZip2SetThreads ( 3 )                                           ;
+  for (int i = 0 ; i < 6 ; i++ )                                  {
+    workers [ i ] . source    = texts [ i & 1 ]                   ;
+    workers [ i ] . reference = refs  [ i & 1 ]                   ;
+    workers [ i ] . options   = Everything ( 1 + i * 3 )          ;
+    workers [ i ] . ok        = false                             ;
+    if ( i == 5 ) workers [ i ] . options . remove ( "Pipeline" ) ;
+    workers [ i ] . start ( )                                     ;
+  }                                                               ;
+  for (int i = 0 ; i < 6 ; i++ ) QVERIFY ( workers [ i ] . wait ( 120000 ) ) ;
+  for (int i = 0 ; i < 6 ; i++ ) QVERIFY ( workers [ i ] . ok   ) ;
+  BZip2SetThreads ( 0 )                                           ;
+}
+
+void tst_Scheduler::statistics(void)
+{
+  QByteArray  text = Sample ( 600000 , 4 )                        ;
+  BZip2SetThreads ( 2 )                                           ;
+  QVariantMap S        = BZip2SchedulerStats ( )                  ;
+  qint64      executed = S [ "Executed" ] . toLongLong ( )        ;
+  QCOMPARE ( S [ "Threads" ] . toInt ( ) , 2                    ) ;
+  QCOMPARE ( Decode ( Compress ( text , 9 , Everything ( 8 ) , 100000 ) ) , text ) ;
+  S = BZip2SchedulerStats ( )                                     ;
+  QVERIFY  ( S [ "Executed" ] . toLongLong ( ) > executed       ) ;
+  QVERIFY  ( S [ "Workers"  ] . toInt ( ) <= 2                  ) ;
+  QCOMPARE ( S [ "Lanes"    ] . toInt ( ) , 0                   ) ;
+  BZip2SetThreads ( 0 )                                           ;
+  QCOMPARE ( BZip2SchedulerStats ( ) [ "Threads" ] . toInt ( ) , QThread::idealThreadCount ( ) ) ;
+}
+
+// one worker , two pipelines that keep their slots queued : while both run
+// the worker serves them in the ratio of their priorities
+void tst_Scheduler::strideShare(void)
+{
+  Streamer    high                                                ;
+  Streamer    low                                                 ;
+  QVariantMap o                                                   ;
+  BZip2SetThreads ( 1 )                                           ;
+  QVariantMap S    = BZip2SchedulerStats ( )                      ;
+  o [ "Pipeline" ] = true                                         ;
+  o [ "Priority" ] = 8                                            ;
+  high . source    = Sample ( 4000000 , 5 )                       ;
+  high . options   = o                                            ;
+  o [ "Priority" ] = 2                                            ;
+  low  . source    = Sample ( 4000000 , 6 )                       ;
+  low  . options   = o                                            ;
+  low  . start ( )                                                ;
+  high . start ( )                                                ;
+  QVERIFY  ( high . wait ( 120000 )                             ) ;
+  QVERIFY  ( low  . wait ( 120000 )                             ) ;
+  qint64 h = Dispatched ( high . stats , 8 ) - Dispatched ( S , 8 ) ;
+  qint64 l = Dispatched ( high . stats , 2 ) - Dispatched ( S , 2 ) ;
+  QVERIFY  ( h >= 40                                            ) ;
+  QVERIFY  ( l >  0                                             ) ;
+  QVERIFY2 ( ( h >= 2 * l ) && ( h <= 8 * l ) ,
+             qPrintable ( QString ( "%1 : %2" ) . arg ( h ) . arg ( l ) ) ) ;
+  BZip2SetThreads ( 0 )                                           ;
+}
+
+void tst_Scheduler::badPriority(void)
+{
+  int bad [ 2 ] = { 0 , 17 }                                      ;
+  for (int i = 0 ; i < 2 ; i++ )                                  {
+    QtBZip2      L                                                ;
+    QVariantList v                                                ;
+    QVariantMap  o                                                ;
+    o [ "Priority" ] = bad [ i ]                                  ;
+    v << 9 << 30 << o                                             ;
+    QCOMPARE ( L . BeginCompress ( v ) , BZ_PARAM_ERROR         ) ;
+    v . clear ( )                                                 ;
+    v << o                                                        ;
+    QCOMPARE ( L . BeginDecompress ( v ) , BZ_PARAM_ERROR       ) ;
+  }                                                               ;
+}
+
+QTEST_GUILESS_MAIN(tst_Scheduler)
+#include "tst_scheduler.moc"
@@ -0,0 +1,113 @@
+#ifndef TST_SAMPLES_H
+#define TST_SAMPLES_H
+
+#include <QtCore>
+#include <QtBZip2>
+
+//////////////////////////////////////////////////////////////////////////////
+// Inputs and round-trip helpers shared by the QtBZip2 auto tests
+//////////////////////////////////////////////////////////////////////////////
+
+// words drawn by a fixed LCG , repetitive enough to compress , varied
+// enough that level 1 needs several blocks for a few hundred KB
+static inline QByteArray Sample(int bytes,quint32 seed)
+{
+  static const char * words [ 8 ] = { "alpha " , "bravo " , "charlie " ,
+                                      "delta " , "echo "  , "foxtrot " ,
+                                      "golf\n" , "hotel " }             ;
+  QByteArray s                                                         ;
+  while ( s . size ( ) < bytes )                                       {
+    seed = seed * 1103515245u + 12345u                                 ;
+    s . append ( words [ ( seed >> 16 ) & 7 ] )                        ;
+    if ( ( ( seed >> 8 ) & 15 ) == 0 ) s . append ( QByteArray::number ( seed ) ) ;
+  }                                                                    ;
+  s . resize ( bytes )                                                 ;
+  return s                                                             ;
+}
+
+// one LCG byte after another , incompressible
+static inline QByteArray Noise(int bytes,quint32 seed)
+{
+  QByteArray s                                 ;
+  while ( s . size ( ) < bytes )               {
+    seed = seed * 1103515245u + 12345u         ;
+    s . append ( (char) ( seed >> 16 ) )       ;
+  }                                            ;
+  return s                                     ;
+}
+
+// streaming compression through BeginCompress ( level , 30 , options ) ,
+// the source fed in pieces of the given size , 0 for all at once
+static inline int Compress                  (
+                    const QByteArray  & data      ,
+                    QByteArray        & bzip2     ,
+                    int                 level     ,
+                    const QVariantMap & options = QVariantMap ( ) ,
+                    int                 piece   = 0 )
+{
+  QtBZip2      L                                                  ;
+  QVariantList v                                                  ;
+  QByteArray   part                                               ;
+  int          rc                                                 ;
+  v << level << 30 << options                                     ;
+  bzip2 . clear ( )                                               ;
+  rc = L . BeginCompress ( v )                                    ;
+  if ( rc != BZ_OK ) return rc                                    ;
+  if ( piece <= 0 ) piece = data . size ( )                       ;
+  for (int at = 0 ; at < data . size ( ) ; at += piece )          {
+    part . clear ( )                                              ;
+    L . doCompress ( data . mid ( at , piece ) , part )           ;
+    bzip2 . append ( part )                                       ;
+  }                                                               ;
+  part . clear ( )                                                ;
+  rc = L . CompressDone ( part )                                  ;
+  L . CleanUp ( )                                                 ;
+  bzip2 . append ( part )                                         ;
+  return rc                                                       ;
+}
+
+static inline QByteArray Compress           (
+                    const QByteArray  & data      ,
+                    int                 level     ,
+                    const QVariantMap & options = QVariantMap ( ) ,
+                    int                 piece   = 0 )
+{
+  QByteArray bzip2                                  ;
+  Compress ( data , bzip2 , level , options , piece ) ;
+  return bzip2                                      ;
+}
+
+// streaming decode with options for BeginDecompress , the archive fed in
+// pieces of the given size , 0 for all at once ; stops at the first error
+static inline int Decode                    (
+                    const QByteArray  & bzip2     ,
+                    QByteArray        & body      ,
+                    const QVariantMap & options = QVariantMap ( ) ,
+                    int                 piece   = 0 )
+{
+  QtBZip2      L                                                  ;
+  QVariantList v                                                  ;
+  int          rc                                                 ;
+  v << options                                                    ;
+  body . clear ( )                                                ;
+  rc = L . BeginDecompress ( v )                                  ;
+  if ( rc != BZ_OK ) return rc                                    ;
+  if ( piece <= 0 ) piece = bzip2 . size ( )                      ;
+  for (int at = 0 ; at < bzip2 . size ( ) ; at += piece )         {
+    rc = L . doDecompress ( bzip2 . mid ( at , piece ) , body )   ;
+    if ( rc < 0 ) break                                           ;
+  }                                                               ;
+  L . DecompressDone ( )                                          ;
+  return rc                                                       ;
+}
+
+// one call to BZip2Uncompress , the standard decoder
+static inline QByteArray Decode(const QByteArray & bzip2,int * rc = NULL)
+{
+  int status                                                 ;
+  QByteArray body = BZip2Uncompress ( bzip2 , QVariantMap ( ) , &status ) ;
+  if ( NULL != rc ) *rc = status                             ;
+  return body                                                ;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_SizeHint : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void withinHint      ( void ) ;
+    void pastHint        ( void ) ;
+    void flushedPastHint ( void ) ;
+} ;
+
+// streaming compression sized for hint bytes , fed in pieces
+static QByteArray Hinted(const QByteArray & data,int level,qint64 hint,int piece)
+{
+  QtBZip2    L                                                    ;
+  QByteArray bzip2                                                ;
+  QByteArray part                                                 ;
+  if ( L . BeginCompress ( level , 30 , hint ) != BZ_OK ) return bzip2 ;
+  for (int at = 0 ; at < data . size ( ) ; at += piece )          {
+    part . clear ( )                                              ;
+    L . doCompress ( data . mid ( at , piece ) , part )           ;
+    bzip2 . append ( part )                                       ;
+  }                                                               ;
+  part . clear ( )                                                ;
+  L . CompressDone ( part )                                       ;
+  L . CleanUp ( )                                                 ;
+  bzip2 . append ( part )                                         ;
+  return bzip2                                                    ;
+}
+
+// a stream that keeps to its hint announces the smaller block size
+void tst_SizeHint::withinHint(void)
+{
+  QByteArray text  = Sample ( 150000 , 1 )                        ;
+  QByteArray bzip2 = Hinted ( text , 9 , text . size ( ) , 4096 ) ;
+  QCOMPARE ( bzip2 [ 3 ] , '2'                                  ) ;
+  QCOMPARE ( Decode ( bzip2 ) , text                            ) ;
+}
+
+// past the hint the stream is the one an unhinted compressor writes
+void tst_SizeHint::pastHint(void)
+{
+  QByteArray text  = Sample ( 2500000 , 2 )                       ;
+  QByteArray noise = Noise  (  300000 , 3 )                       ;
+  QByteArray bzip2 = Hinted ( text , 9 , 1000 , 65536 )           ;
+  QCOMPARE ( bzip2 , Compress ( text , 9 )                      ) ;
+  QCOMPARE ( Decode ( bzip2 ) , text                            ) ;
+  bzip2 = Hinted ( noise , 5 , 200000 , 100000 )                  ;
+  QCOMPARE ( bzip2 , Compress ( noise , 5 )                     ) ;
+  QCOMPARE ( Decode ( bzip2 ) , noise                           ) ;
+}
+
+// a block flushed before the input outgrew the hint
+void tst_SizeHint::flushedPastHint(void)
+{
+  QtBZip2    L                                                    ;
+  QByteArray text = Sample ( 1200000 , 4 )                        ;
+  QByteArray wire                                                 ;
+  QByteArray part                                                 ;
+  QCOMPARE ( L . BeginCompress ( 9 , 30 , 2000 ) , BZ_OK        ) ;
+  QCOMPARE ( L . doCompress ( text . left ( 1500 ) , part ) , BZ_OK ) ;
+  wire . append ( part )                                          ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . Flush ( part ) , BZ_OK                         ) ;
+  wire . append ( part )                                          ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . doCompress ( text . mid ( 1500 ) , part ) , BZ_OK ) ;
+  wire . append ( part )                                          ;
+  part . clear ( )                                                ;
+  QCOMPARE ( L . CompressDone ( part ) , BZ_OK                  ) ;
+  L . CleanUp ( )                                                 ;
+  wire . append ( part )                                          ;
+  QCOMPARE ( wire [ 3 ] , '9'                                   ) ;
+  QCOMPARE ( Decode ( wire ) , text                             ) ;
+  QVERIFY  ( wire . size ( ) < Compress ( text , 1 ) . size ( ) ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_SizeHint)
+#include "tst_sizehint.moc"
@@ -0,0 +1,106 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Sort : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void baselineOutput        ( void ) ;
+    void parallelMatchesSerial ( void ) ;
+    void pathologicalInput     ( void ) ;
+    void sortersAgree          ( void ) ;
+} ;
+
+// one noise unit repeated : every suffix comparison runs a full period
+// deep , so mainSort spends its budget and hands over to fallbackSort
+static QByteArray Periodic(int bytes,int period)
+{
+  QByteArray unit = Noise ( period , 99 )      ;
+  QByteArray s                                 ;
+  while ( s . size ( ) < bytes ) s . append ( unit ) ;
+  s . resize ( bytes )                         ;
+  return s                                     ;
+}
+
+static QVariantMap Threads(int threads)
+{
+  QVariantMap o                 ;
+  o [ "Threads" ] = threads     ;
+  return o                      ;
+}
+
+static QVariantMap Sorter(int sorter,int threads)
+{
+  QVariantMap o = Threads ( threads ) ;
+  o [ "Sort" ] = sorter               ;
+  return o                            ;
+}
+
+// sizes and checksums of the archives the unmodified encoder produced
+void tst_Sort::baselineOutput(void)
+{
+  QByteArray a = Compress ( Sample   ( 300000 ,     7 ) , 1 , Threads ( 1 ) ) ;
+  QByteArray b = Compress ( Sample   ( 300000 ,     7 ) , 9 , Threads ( 1 ) ) ;
+  QByteArray c = Compress ( Noise    ( 200000 ,     5 ) , 9 , Threads ( 1 ) ) ;
+  QByteArray d = Compress ( Periodic ( 400000 , 20000 ) , 9 , Threads ( 1 ) ) ;
+  QCOMPARE ( a . size ( ) ,  36242                              ) ;
+  QCOMPARE ( b . size ( ) ,  35788                              ) ;
+  QCOMPARE ( c . size ( ) , 199841                              ) ;
+  QCOMPARE ( d . size ( ) ,  37866                              ) ;
+  QCOMPARE ( qChecksum ( a . constData ( ) , a . size ( ) ) , (quint16) 0x5836 ) ;
+  QCOMPARE ( qChecksum ( b . constData ( ) , b . size ( ) ) , (quint16) 0xf311 ) ;
+  QCOMPARE ( qChecksum ( c . constData ( ) , c . size ( ) ) , (quint16) 0x4146 ) ;
+  QCOMPARE ( qChecksum ( d . constData ( ) , d . size ( ) ) , (quint16) 0x844d ) ;
+}
+
+void tst_Sort::parallelMatchesSerial(void)
+{
+  QByteArray text  = Sample ( 900000 , 11 )                   ;
+  QByteArray noise = Noise  ( 600000 , 13 )                   ;
+  QByteArray z                                                ;
+  for (int t = 2 ; t <= 8 ; t *= 2 )                          {
+    z = Compress ( text  , 9 , Threads ( t ) )                ;
+    QCOMPARE ( z , Compress ( text  , 9 , Threads ( 1 ) )   ) ;
+    QCOMPARE ( Decode ( z ) , text                          ) ;
+    z = Compress ( noise , 9 , Threads ( t ) )                ;
+    QCOMPARE ( z , Compress ( noise , 9 , Threads ( 1 ) )   ) ;
+    QCOMPARE ( Decode ( z ) , noise                         ) ;
+  }                                                           ;
+}
+
+// tasks give up together on the shared budget , the block still sorts
+void tst_Sort::pathologicalInput(void)
+{
+  QByteArray source = Periodic ( 800000 , 20000 )             ;
+  QByteArray serial = Compress ( source , 9 , Threads ( 1 ) ) ;
+  QCOMPARE ( Compress ( source , 9 , Threads ( 4 ) ) , serial ) ;
+  QCOMPARE ( Decode ( serial ) , source                     ) ;
+  QByteArray flat ( 800000 , 'a' )                            ;
+  QCOMPARE ( Compress ( flat , 9 , Threads ( 4 ) ) , Compress ( flat , 9 , Threads ( 1 ) ) ) ;
+}
+
+// byte , word and fallback sorters produce the same archive
+void tst_Sort::sortersAgree(void)
+{
+  QByteArray inputs [ 5 ] = { Sample   ( 700000 ,    17 ) ,
+                              Noise    ( 300000 ,    19 ) ,
+                              Periodic ( 500000 , 20000 ) ,
+                              Periodic ( 300000 ,     3 ) ,
+                              QByteArray ( 250000 , 'a' ) }  ;
+  for (int i = 0 ; i < 5 ; i++ )                             {
+    QByteArray word = Compress ( inputs [ i ] , 9 , Sorter ( 1 , 1 ) ) ;
+    QCOMPARE ( Decode ( word ) , inputs [ i ]              ) ;
+    for (int sorter = 0 ; sorter < 3 ; sorter++ )            {
+      QCOMPARE ( Compress ( inputs [ i ] , 9 , Sorter ( sorter , 1 ) ) , word ) ;
+      QCOMPARE ( Compress ( inputs [ i ] , 9 , Sorter ( sorter , 4 ) ) , word ) ;
+    }                                                        ;
+  }                                                          ;
+  QByteArray bzip2                                           ;
+  QCOMPARE ( Compress ( inputs [ 0 ] , bzip2 , 9 , Sorter (  3 , 1 ) ) , BZ_PARAM_ERROR ) ;
+  QCOMPARE ( Compress ( inputs [ 0 ] , bzip2 , 9 , Sorter ( -1 , 1 ) ) , BZ_PARAM_ERROR ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Sort)
+#include "tst_sort.moc"
@@ -0,0 +1,76 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+class tst_Speed : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void roundTrip     ( void ) ;
+    void referenceMode ( void ) ;
+    void pipelineSpeed ( void ) ;
+    void badSpeed      ( void ) ;
+} ;
+
+static QVariantMap Speed(int speed)
+{
+  QVariantMap o               ;
+  o [ "Speed" ] = speed       ;
+  return o                    ;
+}
+
+// every mode writes a standard stream , BZip2Uncompress reads it back
+void tst_Speed::roundTrip(void)
+{
+  QByteArray inputs [ 4 ] = { Sample ( 1200000 , 1 )       ,
+                              Noise  (  300000 , 2 )       ,
+                              QByteArray ( 400000 , 'z' )  ,
+                              Sample (    5000 , 3 )       } ;
+  for (int i = 0 ; i < 4 ; i++ )                             {
+    for (int speed = 0 ; speed < 4 ; speed++ )               {
+      for (int level = 1 ; level <= 9 ; level += 8 )         {
+        QByteArray bzip2                                     ;
+        int        rc                                        ;
+        QCOMPARE ( Compress ( inputs [ i ] , bzip2 , level , Speed ( speed ) ) , BZ_OK ) ;
+        QCOMPARE ( Decode ( bzip2 , &rc ) , inputs [ i ]   ) ;
+        QCOMPARE ( rc , BZ_STREAM_END                      ) ;
+      }                                                      ;
+    }                                                        ;
+  }                                                          ;
+}
+
+// mode 0 is the reference encoder , the faster modes trade some ratio
+void tst_Speed::referenceMode(void)
+{
+  QByteArray text      = Sample ( 900000 , 4 )               ;
+  QByteArray reference = Compress ( text , 9 )               ;
+  QCOMPARE ( Compress ( text , 9 , Speed ( 0 ) ) , reference ) ;
+  for (int speed = 1 ; speed < 4 ; speed++ )                 {
+    QByteArray z = Compress ( text , 9 , Speed ( speed ) )   ;
+    QVERIFY  ( z . size ( ) >= reference . size ( )        ) ;
+    QVERIFY  ( z . size ( ) <  reference . size ( ) * 5 / 4 ) ;
+  }                                                          ;
+}
+
+void tst_Speed::pipelineSpeed(void)
+{
+  QByteArray text = Sample ( 700000 , 5 )                    ;
+  for (int speed = 0 ; speed < 4 ; speed++ )                 {
+    QVariantMap o = Speed ( speed )                          ;
+    QByteArray  z = Compress ( text , 1 , o )                ;
+    o [ "Pipeline" ] = true                                  ;
+    QCOMPARE ( Compress ( text , 1 , o , 65536 ) , z       ) ;
+    QCOMPARE ( Decode ( z ) , text                         ) ;
+  }                                                          ;
+}
+
+void tst_Speed::badSpeed(void)
+{
+  QByteArray bzip2                                           ;
+  QCOMPARE ( Compress ( Sample ( 100 , 6 ) , bzip2 , 9 , Speed ( -1 ) ) , BZ_PARAM_ERROR ) ;
+  QCOMPARE ( Compress ( Sample ( 100 , 6 ) , bzip2 , 9 , Speed (  4 ) ) , BZ_PARAM_ERROR ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_Speed)
+#include "tst_speed.moc"
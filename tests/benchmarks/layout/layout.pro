@@ -0,0 +1,17 @@
+QT             = core
+QT            -= gui
+QT            += testlib
+QT            += QtBZip2
+
+CONFIG        += benchmark
+CONFIG        += console
+
+TARGET         = tst_bench_layout
+
+TEMPLATE       = app
+
+INCLUDEPATH   += $${PWD}/../../auto/shared
+
+HEADERS       += $${PWD}/../../auto/shared/samples.h
+
+SOURCES       += $${PWD}/tst_bench_layout.cpp
@@ -0,0 +1,91 @@
+#include <QtCore>
+#include <QtTest>
+#include <QtBZip2>
+#include "samples.h"
+
+// Throughput of the paths that live in the stream state : bsW and
+// ADD_CHAR_TO_BLOCK when compressing , GET_BITS / GET_MTF_VAL and the
+// un-RLE loop when decoding.  Run with -iterations or -callgrind to
+// compare state layouts.
+class tst_BenchLayout : public QObject
+{
+  Q_OBJECT
+  private slots:
+    void initTestCase      ( void ) ;
+    void compressText      ( void ) ;
+    void compressRecords   ( void ) ;
+    void decompressText    ( void ) ;
+    void decompressRecords ( void ) ;
+  private:
+    QByteArray Text                ;
+    QByteArray Records             ;
+    QByteArray TextBZip2           ;
+    QByteArray RecordsBZip2        ;
+} ;
+
+// binary records , poorly compressible , many MTF values per block
+static QByteArray Fields(int bytes,quint32 seed)
+{
+  QByteArray s                                 ;
+  while ( s . size ( ) < bytes )               {
+    seed = seed * 1103515245u + 12345u         ;
+    quint32 v = seed >> 8                      ;
+    s . append ( (char) ( v % 7 )            ) ;
+    s . append ( (char) ( ( v >> 3 ) & 0x3F ) ) ;
+    s . append ( (char) ( v >> 9 )           ) ;
+    s . append ( (char) ( v >> 17 )          ) ;
+  }                                            ;
+  s . resize ( bytes )                         ;
+  return s                                     ;
+}
+
+void tst_BenchLayout::initTestCase(void)
+{
+  Text    = Sample ( 2000000 , 1 )              ;
+  Records = Fields ( 2000000 , 2 )              ;
+  QVERIFY ( ToBZip2 ( Text    , TextBZip2    ) ) ;
+  QVERIFY ( ToBZip2 ( Records , RecordsBZip2 ) ) ;
+}
+
+void tst_BenchLayout::compressText(void)
+{
+  QByteArray bzip2                  ;
+  QBENCHMARK                        {
+    bzip2 . clear ( )               ;
+    ToBZip2 ( Text , bzip2 )        ;
+  }                                 ;
+  QCOMPARE ( bzip2 , TextBZip2    ) ;
+}
+
+void tst_BenchLayout::compressRecords(void)
+{
+  QByteArray bzip2                  ;
+  QBENCHMARK                        {
+    bzip2 . clear ( )               ;
+    ToBZip2 ( Records , bzip2 )     ;
+  }                                 ;
+  QCOMPARE ( bzip2 , RecordsBZip2 ) ;
+}
+
+void tst_BenchLayout::decompressText(void)
+{
+  QByteArray data                   ;
+  QBENCHMARK                        {
+    data . clear ( )                ;
+    FromBZip2 ( TextBZip2 , data )  ;
+  }                                 ;
+  QCOMPARE ( data , Text          ) ;
+}
+
+void tst_BenchLayout::decompressRecords(void)
+{
+  QByteArray data                     ;
+  QBENCHMARK                          {
+    data . clear ( )                  ;
+    FromBZip2 ( RecordsBZip2 , data ) ;
+  }                                   ;
+  QCOMPARE ( data , Records         ) ;
+}
+
+QTEST_GUILESS_MAIN(tst_BenchLayout)
+#include "tst_bench_layout.moc"
@@ -1,3 +1,3 @@
 TEMPLATE = subdirs
 CONFIG  += no_docs_target
-SUBDIRS  = auto
+SUBDIRS  = auto benchmarks